@@ -4,7 +4,6 @@
 #include <vector>
 #include <cctype>
 #include <map>
-#include "dfa.h"
 
 using namespace std;
 
@@ -35,6 +34,54 @@ const string STATES = ".STATES";
 const string TRANSITIONS = ".TRANSITIONS";
 const string INPUT = ".INPUT";
 
+// MIPS tokens; dfa.h holds the WLP4 scanner used by wlp4gen.
+const string MIPS_DFA = R"(
+.STATES
+start
+DOT
+DOLLAR
+MINUS
+ZEROX
+ID!
+LABELDEF!
+DOTID!
+ZERO!
+DECINT!
+HEXINT!
+REGISTER!
+COMMA!
+LPAREN!
+RPAREN!
+?WHITESPACE!
+?COMMENT!
+.TRANSITIONS
+start       a-z A-Z     ID
+ID          a-z A-Z 0-9 ID
+ID          :           LABELDEF
+start       .           DOT
+DOT         a-z A-Z     DOTID
+DOTID       a-z A-Z     DOTID
+start       0           ZERO
+ZERO        x           ZEROX
+ZEROX       0-9 a-f A-F HEXINT
+HEXINT      0-9 a-f A-F HEXINT
+ZERO        0-9         DECINT
+start       1-9         DECINT
+start       -           MINUS
+MINUS       0-9         DECINT
+DECINT      0-9         DECINT
+start       $           DOLLAR
+DOLLAR      0-9         REGISTER
+REGISTER    0-9         REGISTER
+start       ,           COMMA
+start       (           LPAREN
+start       )           RPAREN
+start       \r \s \t    ?WHITESPACE
+?WHITESPACE \r \s \t    ?WHITESPACE
+start       ;           ?COMMENT
+?COMMENT    \x00-\x09 \x0B \x0C \x0E-\x7F ?COMMENT
+)";
+
 struct Token
 {
     string kind;
@@ -404,7 +451,7 @@ map<string, int> firstpass(vector<Token> tokens)
             }
             no = 1;
         }
-        else
+        else if (tokens[i].kind != "NEWLINE")
         {
             start = 0;
         }
@@ -671,7 +718,7 @@ void secondpass(vector<Token> tokens, map<string, int> symboltable)
             }
             no = 1;
         }
-        else
+        else if (tokens[i].kind != "NEWLINE")
         {
             start = 0;
         }
@@ -1037,7 +1084,7 @@ int main()
 
     try
     {
-        stringstream s(DFAstring);
+        stringstream s(MIPS_DFA);
         // call smm function to get tokens
         dfa = createDFA(s);
 
@@ -0,0 +1,73 @@
+#!/bin/sh
+# Allocation benchmark for the runtime that --builtin-runtime includes,
+# against the reference runtime. Each bench/alloc/<name>.wlp4 runs in
+# mipsemu at two iteration counts, and the difference in instructions is
+# the cost of one iteration of its loop, leaving out init, the setup around
+# the loop and the final println.
+#     bench/alloc.sh runtime.asm
+# runtime.asm defines print, init, new and delete with the usual
+# conventions; it is appended in place of the imports and must print the
+# same results. Tools are built in $BUILD (default _test_build).
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+build=${BUILD:-$root/_test_build}
+cxx=${CXX:-g++}
+runtime=$1
+if [ $# -ne 1 ] || [ ! -r "$runtime" ]; then
+    echo "usage: bench/alloc.sh runtime.asm (the reference runtime to compare against)" >&2
+    exit 2
+fi
+mkdir -p "$build" || exit 1
+
+$cxx -std=c++17 -O2 -o "$build/wlp4gen" "$root/wlp4gen.cc" "$root/wlp4data.cc" "$root/mipshelper.cc" || exit 1
+$cxx -std=c++17 -O2 -o "$build/asm" "$root/asm.cc" || exit 1
+$cxx -std=c++17 -O2 -o "$build/mipsemu" "$root/mipsemu.cc" || exit 1
+
+# assemble bench/alloc/$1.wlp4 into $build/$1.$2.mips with the built-in
+# runtime, or with runtime.asm appended in place of the imports
+assemble()
+{
+    if [ "$2" = builtin ]; then
+        "$build/wlp4gen" --builtin-runtime < "$root/bench/alloc/$1.wlp4" > "$build/bench.asm" || return 1
+    else
+        "$build/wlp4gen" < "$root/bench/alloc/$1.wlp4" | grep -v "^\.import" > "$build/bench.asm" || return 1
+        cat "$runtime" >> "$build/bench.asm"
+    fi
+    "$build/asm" < "$build/bench.asm" > "$build/$1.$2.mips" 2> "$build/bench.err" && [ ! -s "$build/bench.err" ]
+}
+
+# run $build/$1.$2.mips on $3 iterations of size $4: sets output and steps
+run()
+{
+    output=$(printf '%s\n%s\n' "$3" "$4" | "$build/mipsemu" twoints "$build/$1.$2.mips" 2> "$build/bench.err") || return 1
+    steps=$(sed -n 's/^instructions: //p' "$build/bench.err")
+}
+
+status=0
+printf '%-8s %6s %14s %14s   (instructions per iteration)\n' workload size builtin "$(basename "$runtime")"
+# workload, block size or largest size, iterations of the two runs
+for line in "same 8 1000 3000" "same 40 1000 3000" "list 2 1000 3000" "list 24 1000 3000" "mixed 16 1000 3000" "mixed 60 1000 3000"; do
+    set -- $line
+    name=$1 size=$2 low=$3 high=$4
+    printf '%-8s %6s' "$name" "$size"
+    for kind in builtin other; do
+        if ! assemble "$name" $kind || ! run "$name" $kind "$low" "$size"; then
+            printf ' %14s' failed
+            status=1
+            continue
+        fi
+        first=$steps
+        lowOutput=$output
+        run "$name" $kind "$high" "$size" || { printf ' %14s' failed; status=1; continue; }
+        if [ $kind = builtin ]; then
+            expected="$lowOutput $output"
+        elif [ "$expected" != "$lowOutput $output" ]; then
+            printf ' %14s' "wrong output"
+            status=1
+            continue
+        fi
+        printf ' %14s' $(( (steps - first) / (high - low) ))
+    done
+    printf '\n'
+done
+exit $status
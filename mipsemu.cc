@@ -0,0 +1,424 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+using namespace std;
+
+//// MIPS EMULATOR ////////////////////////////////////////////////
+// Runs the machine code asm.cc writes: big-endian words loaded at address 0,
+// $30 at the top of memory and $31 holding the address that ends the run.
+//     mipsemu twoints prog.mips   reads $1 and $2 from stdin
+//     mipsemu array prog.mips     reads a length and the elements; the array
+//                                 is put after the program, $1 = its address
+//                                 and $2 = its length
+// Words stored to 0xffff000c print their low byte, words loaded from
+// 0xffff0004 read a byte of stdin (-1 at the end). The registers, the
+// instruction count and instructions per second go to stderr.
+//
+// Every word is decoded once into an Instruction before the run and the
+// loop jumps straight from one handler to the next through a table of label
+// addresses (a GCC extension), instead of going back to a switch.
+
+const uint32_t memorySize = 0x01000000; // bytes
+const uint32_t returnAddress = 0x8123456c;
+const uint32_t printPort = 0xffff000c;
+const uint32_t readPort = 0xffff0004;
+
+enum Opcode
+{
+    ADD,
+    SUB,
+    SLT,
+    SLTU,
+    MULT,
+    MULTU,
+    DIV,
+    DIVU,
+    MFHI,
+    MFLO,
+    LIS,
+    JR,
+    JALR,
+    BEQ,
+    BNE,
+    LW,
+    SW,
+    INVALID
+};
+
+struct Instruction
+{
+    uint8_t op;
+    uint8_t s;
+    uint8_t t;
+    uint8_t d;
+    int32_t immediate;
+};
+
+Instruction decode(uint32_t word)
+{
+    Instruction instruction{INVALID, (uint8_t)((word >> 21) & 31), (uint8_t)((word >> 16) & 31), (uint8_t)((word >> 11) & 31), (int16_t)(word & 0xffff)};
+    uint32_t opcode = word >> 26;
+    uint32_t function = word & 0x7ff;
+    if (opcode == 0)
+    {
+        // R-type: registers that are not operands must be zero
+        bool noT = instruction.t == 0;
+        bool noD = instruction.d == 0;
+        bool noS = instruction.s == 0;
+        switch (function)
+        {
+        case 0x20:
+            instruction.op = ADD;
+            break;
+        case 0x22:
+            instruction.op = SUB;
+            break;
+        case 0x2a:
+            instruction.op = SLT;
+            break;
+        case 0x2b:
+            instruction.op = SLTU;
+            break;
+        case 0x18:
+            instruction.op = noD ? MULT : INVALID;
+            break;
+        case 0x19:
+            instruction.op = noD ? MULTU : INVALID;
+            break;
+        case 0x1a:
+            instruction.op = noD ? DIV : INVALID;
+            break;
+        case 0x1b:
+            instruction.op = noD ? DIVU : INVALID;
+            break;
+        case 0x10:
+            instruction.op = noS && noT ? MFHI : INVALID;
+            break;
+        case 0x12:
+            instruction.op = noS && noT ? MFLO : INVALID;
+            break;
+        case 0x14:
+            instruction.op = noS && noT ? LIS : INVALID;
+            break;
+        case 0x08:
+            instruction.op = noT && noD ? JR : INVALID;
+            break;
+        case 0x09:
+            instruction.op = noT && noD ? JALR : INVALID;
+            break;
+        }
+    }
+    else if (opcode == 0x04)
+    {
+        instruction.op = BEQ;
+    }
+    else if (opcode == 0x05)
+    {
+        instruction.op = BNE;
+    }
+    else if (opcode == 0x23)
+    {
+        instruction.op = LW;
+    }
+    else if (opcode == 0x2b)
+    {
+        instruction.op = SW;
+    }
+    return instruction;
+}
+
+struct Machine
+{
+    vector<uint32_t> memory;     // words
+    vector<Instruction> program; // decoded words of the loaded code
+    uint32_t registers[32];
+    uint32_t hi;
+    uint32_t lo;
+    uint64_t steps;
+};
+
+void load(Machine &machine, istream &in)
+{
+    machine.memory.assign(memorySize / 4, 0);
+    unsigned char bytes[4];
+    size_t words = 0;
+    while (in.read((char *)bytes, 4))
+    {
+        if (words == machine.memory.size())
+        {
+            throw runtime_error("ERROR: program does not fit in memory");
+        }
+        machine.memory[words++] = (uint32_t)bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+    }
+    if (in.gcount() != 0)
+    {
+        throw runtime_error("ERROR: program is not a whole number of words");
+    }
+    for (size_t i = 0; i < words; i++)
+    {
+        machine.program.push_back(decode(machine.memory[i]));
+    }
+    for (auto &r : machine.registers)
+    {
+        r = 0;
+    }
+    machine.registers[30] = memorySize;
+    machine.registers[31] = returnAddress;
+    machine.hi = machine.lo = 0;
+    machine.steps = 0;
+}
+
+int readInt(string prompt)
+{
+    cerr << prompt;
+    long long value;
+    if (!(cin >> value))
+    {
+        throw runtime_error("ERROR: expected an integer");
+    }
+    return (int)value;
+}
+
+void run(Machine &machine)
+{
+    static void *handlers[] = {&&add, &&sub, &&slt, &&sltu, &&mult, &&multu, &&div, &&divu, &&mfhi, &&mflo, &&lis, &&jr, &&jalr, &&beq, &&bne, &&lw, &&sw, &&invalid};
+    uint32_t *r = machine.registers;
+    uint32_t *memory = machine.memory.data();
+    Instruction *program = machine.program.data();
+    uint32_t size = machine.program.size();
+    uint32_t pc = 0; // index of the next instruction
+    uint64_t steps = 0;
+    Instruction *current;
+    uint32_t address;
+
+// fetch the instruction at pc, leaving the loop past the end of the code
+#define DISPATCH()                      \
+    if (pc >= size)                     \
+    {                                   \
+        goto outside;                   \
+    }                                   \
+    current = &program[pc++];           \
+    steps++;                            \
+    goto *handlers[current->op];
+#define S r[current->s]
+#define T r[current->t]
+#define D r[current->d]
+
+    DISPATCH();
+add:
+    D = S + T;
+    r[0] = 0;
+    DISPATCH();
+sub:
+    D = S - T;
+    r[0] = 0;
+    DISPATCH();
+slt:
+    D = (int32_t)S < (int32_t)T;
+    r[0] = 0;
+    DISPATCH();
+sltu:
+    D = S < T;
+    r[0] = 0;
+    DISPATCH();
+mult:
+{
+    int64_t product = (int64_t)(int32_t)S * (int32_t)T;
+    machine.hi = (uint64_t)product >> 32;
+    machine.lo = (uint32_t)product;
+}
+    DISPATCH();
+multu:
+{
+    uint64_t product = (uint64_t)S * T;
+    machine.hi = product >> 32;
+    machine.lo = (uint32_t)product;
+}
+    DISPATCH();
+div:
+    if (T == 0)
+    {
+        throw runtime_error("ERROR: division by zero");
+    }
+    if ((int32_t)S == INT32_MIN && (int32_t)T == -1)
+    {
+        // the quotient does not fit, and the hardware leaves it wrapped
+        machine.lo = S;
+        machine.hi = 0;
+    }
+    else
+    {
+        machine.lo = (int32_t)S / (int32_t)T;
+        machine.hi = (int32_t)S % (int32_t)T;
+    }
+    DISPATCH();
+divu:
+    if (T == 0)
+    {
+        throw runtime_error("ERROR: division by zero");
+    }
+    machine.lo = S / T;
+    machine.hi = S % T;
+    DISPATCH();
+mfhi:
+    D = machine.hi;
+    r[0] = 0;
+    DISPATCH();
+mflo:
+    D = machine.lo;
+    r[0] = 0;
+    DISPATCH();
+lis:
+    if (pc >= size)
+    {
+        throw runtime_error("ERROR: lis at the end of the program");
+    }
+    D = memory[pc++];
+    r[0] = 0;
+    DISPATCH();
+jalr:
+    address = S;
+    r[31] = pc * 4;
+    goto jump;
+jr:
+    address = S;
+jump:
+    if (address == returnAddress)
+    {
+        goto done;
+    }
+    if (address % 4 != 0)
+    {
+        throw runtime_error("ERROR: jump to an unaligned address");
+    }
+    pc = address / 4;
+    DISPATCH();
+beq:
+    if (S == T)
+    {
+        pc += current->immediate;
+    }
+    DISPATCH();
+bne:
+    if (S != T)
+    {
+        pc += current->immediate;
+    }
+    DISPATCH();
+lw:
+    address = S + current->immediate;
+    if (address == readPort)
+    {
+        int c = getchar();
+        T = c == EOF ? -1 : c;
+    }
+    else if (address % 4 != 0 || address >= memorySize)
+    {
+        throw runtime_error("ERROR: bad load address");
+    }
+    else
+    {
+        T = memory[address / 4];
+    }
+    r[0] = 0;
+    DISPATCH();
+sw:
+    address = S + current->immediate;
+    if (address == printPort)
+    {
+        putchar(T & 0xff);
+    }
+    else if (address % 4 != 0 || address >= memorySize)
+    {
+        throw runtime_error("ERROR: bad store address");
+    }
+    else
+    {
+        memory[address / 4] = T;
+        // code that is overwritten is decoded again
+        if (address / 4 < size)
+        {
+            program[address / 4] = decode(T);
+        }
+    }
+    DISPATCH();
+invalid:
+    throw runtime_error("ERROR: invalid instruction");
+outside:
+    throw runtime_error("ERROR: ran past the end of the program");
+done:
+    machine.steps = steps;
+
+#undef DISPATCH
+#undef S
+#undef T
+#undef D
+}
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        string mode = argc == 3 ? argv[1] : "";
+        if (mode != "twoints" && mode != "array")
+        {
+            throw runtime_error("ERROR: usage: mipsemu twoints|array prog.mips");
+        }
+        ifstream in(argv[2], ios::binary);
+        if (!in)
+        {
+            throw runtime_error("ERROR: cannot read " + string(argv[2]));
+        }
+        Machine machine;
+        load(machine, in);
+        if (mode == "twoints")
+        {
+            machine.registers[1] = readInt("Enter value for register 1: ");
+            machine.registers[2] = readInt("Enter value for register 2: ");
+        }
+        else
+        {
+            int length = readInt("Enter length of array: ");
+            uint32_t base = machine.program.size();
+            if (length < 0 || base + length > machine.memory.size() / 2)
+            {
+                throw runtime_error("ERROR: bad array length");
+            }
+            for (int i = 0; i < length; i++)
+            {
+                machine.memory[base + i] = readInt("Enter array element " + to_string(i) + ": ");
+            }
+            machine.registers[1] = base * 4;
+            machine.registers[2] = length;
+        }
+        cin.ignore(1); // the rest of stdin is for the program
+
+        auto begin = chrono::steady_clock::now();
+        run(machine);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        fflush(stdout);
+
+        cerr << "MIPS program completed normally." << endl;
+        for (int i = 1; i < 32; i++)
+        {
+            char line[32];
+            snprintf(line, sizeof line, "$%02d = 0x%08x   ", i, machine.registers[i]);
+            cerr << line << (i % 4 == 0 || i == 31 ? "\n" : "");
+        }
+        cerr << "instructions: " << machine.steps << endl;
+        cerr << "instructions per second: " << (seconds > 0 ? (long long)(machine.steps / seconds) : 0) << endl;
+    }
+    catch (runtime_error &e)
+    {
+        fflush(stdout);
+        cerr << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
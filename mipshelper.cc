@@ -1,74 +1,285 @@
 #include "mipshelper.h"
 
+vector<string> code;
+
+void emit(string line){
+    code.push_back(line);
+}
+void printCode(){
+    for (auto &line : code) {
+        cout << line << "\n";
+    }
+    code.clear();
+}
+
+//// BLOCK LAYOUT ////
+// A basic block: its labels, the instructions in it and how it ends.
+// Branches with a numeric offset only skip within a block and are kept
+// as ordinary instructions.
+struct Block {
+    vector<string> labels;
+    vector<string> body;
+    string branch; // label a conditional branch at the end goes to
+    string jump;   // label an unconditional jump at the end goes to
+    bool falls;    // control can run on into the next block
+};
+
+string branchTarget(string line){
+    return line.substr(line.rfind(' ') + 1);
+}
+
+bool isBranch(string line){
+    string target = branchTarget(line);
+    return (line.rfind("beq ", 0) == 0 || line.rfind("bne ", 0) == 0) && !isdigit(target[0]) && target[0] != '-';
+}
+
+// beq $x, $x always branches
+bool alwaysBranches(string line){
+    size_t first = line.find(' ') + 1;
+    size_t comma = line.find(',');
+    return line.rfind("beq ", 0) == 0 && line.substr(first, comma - first) == line.substr(comma + 2, line.rfind(',') - comma - 2);
+}
+
+vector<Block> splitBlocks(){
+    vector<Block> blocks(1);
+    blocks[0].falls = true;
+    for (size_t i = 0; i < code.size(); i++) {
+        Block &current = blocks.back();
+        bool ended = current.jump != "" || !current.falls || current.branch != "";
+        if (code[i].back() == ':') {
+            if (ended || !current.body.empty()) {
+                blocks.push_back(Block());
+                blocks.back().falls = true;
+            }
+            blocks.back().labels.push_back(code[i].substr(0, code[i].size() - 1));
+            continue;
+        }
+        if (ended) {
+            blocks.push_back(Block());
+            blocks.back().falls = true;
+        }
+        Block &block = blocks.back();
+        if (isBranch(code[i]) && alwaysBranches(code[i])) {
+            block.jump = branchTarget(code[i]);
+            block.falls = false;
+        }
+        else if (isBranch(code[i])) {
+            block.branch = branchTarget(code[i]);
+            block.body.push_back(code[i]);
+        }
+        else if (code[i].rfind("lis ", 0) == 0 && i + 2 < code.size() && code[i + 1].rfind(".word ", 0) == 0 && !isdigit(code[i + 1][6]) && code[i + 1][6] != '-' && code[i + 2] == "jr " + code[i].substr(4)) {
+            block.jump = code[i + 1].substr(6);
+            block.falls = false;
+            i += 2;
+        }
+        else {
+            block.body.push_back(code[i]);
+            if (code[i].rfind("jr ", 0) == 0) {
+                block.falls = false;
+            }
+        }
+    }
+    return blocks;
+}
+
+// Rebuild the code from blocks in the given order. A jump or branch to the
+// block that follows is dropped, and a conditional branch over a block that
+// only jumps becomes one inverted branch.
+void joinBlocks(vector<Block> &blocks, vector<int> &order){
+    code.clear();
+    for (size_t k = 0; k < order.size(); k++) {
+        Block &block = blocks[order[k]];
+        Block *next = k + 1 < order.size() ? &blocks[order[k + 1]] : nullptr;
+        Block *after = k + 2 < order.size() ? &blocks[order[k + 2]] : nullptr;
+        auto startsAt = [](Block *b, string target){
+            return b != nullptr && find(b->labels.begin(), b->labels.end(), target) != b->labels.end();
+        };
+        for (auto &name : block.labels) {
+            code.push_back(name + ":");
+        }
+        code.insert(code.end(), block.body.begin(), block.body.end());
+        if (block.branch != "" && startsAt(next, block.branch)) {
+            code.pop_back();
+        }
+        else if (block.branch != "" && next->labels.empty() && next->body.empty() && next->jump != "" && startsAt(after, block.branch)) {
+            string &last = code.back();
+            last = (last.rfind("beq ", 0) == 0 ? "bne " : "beq ") + last.substr(4, last.rfind(' ') - 3) + next->jump;
+            k++;
+            if (startsAt(after, next->jump)) {
+                code.pop_back();
+            }
+        }
+        if (block.jump != "" && !startsAt(next, block.jump)) {
+            code.push_back("beq $0, $0, " + block.jump);
+        }
+    }
+}
+
+// Lay out the blocks of the program to fall through where it can. Branches
+// to a block that only jumps go straight to where it jumps, and a chain of
+// blocks that is only entered by a jump is moved after the jump.
+void layoutBlocks(){
+    vector<Block> blocks = splitBlocks();
+    map<string, int> blockOf;
+    for (size_t b = 0; b < blocks.size(); b++) {
+        for (auto &name : blocks[b].labels) {
+            blockOf[name] = b;
+        }
+    }
+    auto thread = [&](string target){
+        for (size_t steps = 0; steps < blocks.size() && blockOf.count(target); steps++) {
+            Block &to = blocks[blockOf[target]];
+            if (!to.body.empty() || to.jump == "" || to.jump == target) {
+                break;
+            }
+            target = to.jump;
+        }
+        return target;
+    };
+    for (auto &block : blocks) {
+        if (block.branch != "") {
+            string target = thread(block.branch);
+            block.body.back() = block.body.back().substr(0, block.body.back().rfind(' ') + 1) + target;
+            block.branch = target;
+        }
+        if (block.jump != "") {
+            block.jump = thread(block.jump);
+        }
+    }
+
+    // chains of blocks that fall into each other stay together
+    vector<int> chainOf(blocks.size());
+    vector<vector<int>> chains;
+    for (size_t b = 0; b < blocks.size(); b++) {
+        if (b == 0 || !blocks[b - 1].falls) {
+            chains.push_back({});
+        }
+        chains.back().push_back(b);
+        chainOf[b] = chains.size() - 1;
+    }
+    vector<bool> placed(chains.size(), false);
+    vector<int> order;
+    for (size_t c = 0; c < chains.size(); c++) {
+        for (int chain = c; chain != -1 && !placed[chain];) {
+            placed[chain] = true;
+            order.insert(order.end(), chains[chain].begin(), chains[chain].end());
+            // follow the jump at the end into a chain that starts at its
+            // target, or else a branch around that jump to where it can
+            // become the inverted branch
+            vector<int> &current = chains[chain];
+            Block &tail = blocks[current.back()];
+            vector<string> targets = {tail.jump};
+            if (tail.jump != "" && tail.labels.empty() && tail.body.empty() && current.size() > 1) {
+                targets.push_back(blocks[current[current.size() - 2]].branch);
+            }
+            chain = -1;
+            for (auto &target : targets) {
+                if (chain == -1 && blockOf.count(target)) {
+                    int next = chainOf[blockOf[target]];
+                    if (chains[next].front() == blockOf[target] && !placed[next] && !blocks[chains[next].back()].falls) {
+                        chain = next;
+                    }
+                }
+            }
+        }
+    }
+    joinBlocks(blocks, order);
+}
+
+string regName(int r){
+    return "$" + to_string(r);
+}
+
 void add(int d, int s, int t){
-    cout << "add $" << d << ", $" << s << ", $" << t << "\n"; 
+    emit("add " + regName(d) + ", " + regName(s) + ", " + regName(t));
 }
 void sub(int d, int s, int t){
-    cout << "sub $" << d << ", $" << s << ", $" << t << "\n"; 
+    emit("sub " + regName(d) + ", " + regName(s) + ", " + regName(t));
 }
 void mult(int s, int t){
-    cout << "mult $" << s << ", $" << t << "\n"; 
+    emit("mult " + regName(s) + ", " + regName(t));
 }
 void divide(int s, int t){
-    cout << "div $" << s << ", $" << t << "\n"; 
+    emit("div " + regName(s) + ", " + regName(t));
 }
 void mfhi(int d){
-    cout << "mfhi $" << d << "\n";
+    emit("mfhi " + regName(d));
 }
 void mflo(int d){
-    cout << "mflo $" << d << "\n";
+    emit("mflo " + regName(d));
 }
 void lis(int d){
-    cout << "lis $" << d << "\n";
+    emit("lis " + regName(d));
 }
 void slt(int d, int s, int t){
-    cout<< "slt $" << d << ", $" << s << ", $" << t << "\n";
+    emit("slt " + regName(d) + ", " + regName(s) + ", " + regName(t));
 }
 
 void sltu(int d, int s, int t){
-    cout<< "sltu $" << d << ", $" << s << ", $" << t << "\n";
+    emit("sltu " + regName(d) + ", " + regName(s) + ", " + regName(t));
 }
 
 void jr(int s){
-    cout << "jr $"  << s << "\n"; 
+    emit("jr " + regName(s));
 }
 void jalr(int s){
-    cout << "jalr $"  << s << "\n"; 
+    emit("jalr " + regName(s));
 }
 
 void beq(int s, int t, string label){
-    cout << "beq $" << s << ", $" << t << ", " + label + "\n"; 
+    emit("beq " + regName(s) + ", " + regName(t) + ", " + label);
 }
 void bne(int s, int t, string label){
-    cout << "bne $" << s << ", $" << t << ", " + label + "\n"; 
+    emit("bne " + regName(s) + ", " + regName(t) + ", " + label);
 }
 
 void lw(int t, int i, int s) {
-    cout << "lw $" << t << ", " << i << "($" << s << ")\n";
+    emit("lw " + regName(t) + ", " + to_string(i) + "(" + regName(s) + ")");
 }
 void sw(int t, int i, int s) {
-    cout << "sw $" << t << ", " << i << "($" << s << ")\n";
+    emit("sw " + regName(t) + ", " + to_string(i) + "(" + regName(s) + ")");
 }
 
 void word(int i){
-    cout << ".word " << i << "\n";
+    emit(".word " + to_string(i));
 }
 void word(string label){
-    cout << ".word " + label + "\n";
+    emit(".word " + label);
 }
 void label(string name){
-    cout << name + ":\n";
+    emit(name + ":");
 }
 
 void push(int s){
-    cout<< "sw $"<< s <<", -4($30)\n";
-    cout<< "sub $30, $30, $4\n";
+    sw(s, -4, 30);
+    sub(30, 30, 4);
 }
 
 void pop(int d){
-    cout<< "add $30, $30, $4\n";
-    cout<< "lw $"<< d << ", -4($30)\n";
+    add(30, 30, 4);
+    lw(d, -4, 30);
 }
 void pop(){
-    cout<< "add $30, $30, $4\n";
-}
\ No newline at end of file
+    add(30, 30, 4);
+}
+// move $30 by count words in one adjustment, using $5 for the size
+void reserve(int count){
+    if (count == 1) {
+        sub(30, 30, 4);
+    }
+    else if (count > 1) {
+        lis(5);
+        word(4 * count);
+        sub(30, 30, 5);
+    }
+}
+void drop(int count){
+    if (count == 1) {
+        add(30, 30, 4);
+    }
+    else if (count > 1) {
+        lis(5);
+        word(4 * count);
+        add(30, 30, 5);
+    }
+}
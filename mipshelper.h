@@ -11,6 +11,12 @@
 #include <algorithm>
 using namespace std;
 
+// instructions are collected here and written out by printCode
+extern vector<string> code;
+void emit(string line);
+void printCode();
+void layoutBlocks();
+
 void add(int d, int s, int t);
 void sub(int d, int s, int t);
 void mult(int s, int t);
@@ -35,5 +41,7 @@ void label(string name);
 void push(int s);
 void pop(int d);
 void pop();
+void reserve(int count);
+void drop(int count);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Compiles every tests/<group>/<name>.wlp4 at -O0, -O1 and -O2 with the
+# built-in runtime, assembles it with asm and runs it in mipsemu on
+# <name>.in, checking that the output matches <name>.out. A wain taking an
+# int* reads <name>.in as an array, any other wain as two ints.
+#     tests/run.sh [build directory]
+# The build directory (default _test_build) gets wlp4gen, asm and mipsemu.
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+build=${1:-$root/_test_build}
+cxx=${CXX:-g++}
+mkdir -p "$build" || exit 1
+
+$cxx -std=c++17 -O2 -o "$build/wlp4gen" "$root/wlp4gen.cc" "$root/wlp4data.cc" "$root/mipshelper.cc" || exit 1
+$cxx -std=c++17 -O2 -o "$build/asm" "$root/asm.cc" || exit 1
+$cxx -std=c++17 -O2 -o "$build/mipsemu" "$root/mipsemu.cc" || exit 1
+
+passed=0
+failed=0
+for source in "$root"/tests/*/*.wlp4; do
+    name=${source%.wlp4}
+    mode=twoints
+    if grep -q "wain *( *int *\*" "$source"; then
+        mode=array
+    fi
+    for level in -O0 -O1 -O2; do
+        test=${name#$root/tests/}$level
+        if "$build/wlp4gen" $level --builtin-runtime < "$source" > "$build/test.asm" &&
+            "$build/asm" < "$build/test.asm" > "$build/test.mips" 2> "$build/test.err" &&
+            [ ! -s "$build/test.err" ] &&
+            "$build/mipsemu" $mode "$build/test.mips" < "$name.in" > "$build/test.out" 2> /dev/null &&
+            cmp -s "$build/test.out" "$name.out"; then
+            passed=$((passed + 1))
+        else
+            failed=$((failed + 1))
+            echo "FAIL $test"
+        fi
+    done
+done
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]
@@ -924,3 +924,238 @@ const std::string WLP4_REDUCTIONS = R"END(.REDUCTIONS
 
 const std::string WLP4_DFA = WLP4_TRANSITIONS+WLP4_REDUCTIONS;
 const std::string WLP4_COMBINED = WLP4_CFG+WLP4_DFA;
+
+// print, init, new and delete for --builtin-runtime. The generated code sets
+// $4 = 4 before calling init, and these rely on that. print and delete may
+// change $1 and $3, new returns in $3 and may change $1; every other
+// register is kept, saved below $30 without moving it.
+const std::string WLP4_RUNTIME = R"END(
+; print: $1 in decimal and a newline
+print:
+sw $2, -4($30)
+sw $5, -8($30)
+sw $6, -12($30)
+sw $7, -16($30)
+lis $5
+.word 0xffff000c
+lis $3
+.word 48
+lis $6
+.word 10
+slt $7, $1, $0
+beq $7, $0, rtPrintSmall
+lis $7
+.word 45
+sw $7, 0($5)
+sub $1, $0, $1
+; one digit is written straight away
+rtPrintSmall:
+sltu $7, $1, $6
+beq $7, $0, rtPrintDigits
+add $7, $1, $3
+sw $7, 0($5)
+beq $0, $0, rtPrintDone
+; otherwise digits are stacked from the last one, the magnitude read unsigned.
+; n / 10 is a multiply-high by a reciprocal: hi(n * 0x66666667) / 4 holds
+; up to 2^31, the division by 4 being a multu by 2^30 keeping the high word;
+; the later quotients are below 2^28, where hi(n * 0x1999999a) is n / 10
+rtPrintDigits:
+lis $2
+.word 20
+sub $2, $30, $2
+lis $6
+.word 0x66666667
+multu $1, $6
+mfhi $6
+lis $7
+.word 0x40000000
+multu $6, $7
+mfhi $6
+beq $0, $0, rtPrintDigit
+rtPrintDivide:
+lis $6
+.word 0x1999999a
+multu $1, $6
+mfhi $6
+; the digit is n - 10 * (n / 10)
+rtPrintDigit:
+add $7, $6, $6
+add $7, $7, $7
+add $7, $7, $6
+add $7, $7, $7
+sub $7, $1, $7
+add $7, $7, $3
+sw $7, 0($2)
+sub $2, $2, $4
+add $1, $6, $0
+bne $1, $0, rtPrintDivide
+lis $6
+.word 20
+sub $6, $30, $6
+rtPrintWrite:
+add $2, $2, $4
+lw $7, 0($2)
+sw $7, 0($5)
+bne $2, $6, rtPrintWrite
+rtPrintDone:
+lis $7
+.word 10
+sw $7, 0($5)
+lw $2, -4($30)
+lw $5, -8($30)
+lw $6, -12($30)
+lw $7, -16($30)
+jr $31
+
+; init: the heap starts after the program, or after the array in $1/$2
+; when wain takes one, and gets half of the memory up to the stack
+init:
+sw $1, -4($30)
+sw $2, -8($30)
+sw $5, -12($30)
+sw $6, -16($30)
+lis $5
+.word rtEnd
+slt $6, $0, $2
+beq $6, $0, rtInitHeap
+add $2, $2, $2
+add $2, $2, $2
+add $2, $1, $2
+sltu $6, $5, $2
+beq $6, $0, rtInitHeap
+add $5, $2, $0
+rtInitHeap:
+lis $6
+.word rtHeap
+sw $5, 0($6)
+sub $2, $30, $5
+lis $6
+.word 8
+divu $2, $6
+mflo $2
+add $2, $2, $2
+add $2, $2, $2
+add $2, $5, $2
+lis $6
+.word rtLimit
+sw $2, 0($6)
+lw $1, -4($30)
+lw $2, -8($30)
+lw $5, -12($30)
+lw $6, -16($30)
+jr $31
+
+; new: $3 = a block of $1 words, or 0 when $1 < 1 or the heap is full.
+; A block has a header word holding its size. Freed blocks of 1 to 16
+; words go on a list per size, so those sizes are reused in constant time;
+; larger ones share the list at rtFree and are reused first fit.
+new:
+sw $2, -4($30)
+sw $5, -8($30)
+sw $6, -12($30)
+add $3, $0, $0
+slt $5, $0, $1
+beq $5, $0, rtNewDone
+lis $6
+.word rtFree
+lis $5
+.word 17
+slt $5, $1, $5
+beq $5, $0, rtNewLarge
+add $5, $1, $1
+add $5, $5, $5
+add $6, $6, $5
+lw $3, 0($6)
+beq $3, $0, rtNewBump
+lw $5, 0($3)
+sw $5, 0($6)
+beq $0, $0, rtNewDone
+; no request larger than memory can fit, and checking keeps 4 * $1 exact
+rtNewLarge:
+lis $5
+.word 4194304
+slt $5, $1, $5
+beq $5, $0, rtNewDone
+rtNewFirstFit:
+lw $3, 0($6)
+beq $3, $0, rtNewBump
+lw $5, -4($3)
+slt $5, $5, $1
+bne $5, $0, rtNewNext
+lw $5, 0($3)
+sw $5, 0($6)
+beq $0, $0, rtNewDone
+rtNewNext:
+add $6, $3, $0
+beq $0, $0, rtNewFirstFit
+rtNewBump:
+lis $6
+.word rtHeap
+lw $3, 0($6)
+add $5, $1, $1
+add $5, $5, $5
+add $5, $5, $3
+add $5, $5, $4
+lis $2
+.word rtLimit
+lw $2, 0($2)
+sltu $2, $2, $5
+beq $2, $0, rtNewFits
+add $3, $0, $0
+beq $0, $0, rtNewDone
+rtNewFits:
+sw $5, 0($6)
+sw $1, 0($3)
+add $3, $3, $4
+rtNewDone:
+lw $2, -4($30)
+lw $5, -8($30)
+lw $6, -12($30)
+jr $31
+
+; delete: push the block at $1 on the list for its size
+delete:
+sw $5, -4($30)
+lw $5, -4($1)
+lis $3
+.word 17
+slt $3, $5, $3
+bne $3, $0, rtDeleteSmall
+add $5, $0, $0
+rtDeleteSmall:
+add $5, $5, $5
+add $5, $5, $5
+lis $3
+.word rtFree
+add $3, $3, $5
+lw $5, 0($3)
+sw $5, 0($1)
+sw $1, 0($3)
+lw $5, -4($30)
+jr $31
+
+; next free address, the end of the heap and the free lists
+rtHeap:
+.word 0
+rtLimit:
+.word 0
+rtFree:
+.word 0
+.word 0
+.word 0
+.word 0
+.word 0
+.word 0
+.word 0
+.word 0
+.word 0
+.word 0
+.word 0
+.word 0
+.word 0
+.word 0
+.word 0
+.word 0
+.word 0
+rtEnd:
+)END";
@@ -7,5 +7,6 @@ extern const std::string WLP4_TRANSITIONS;
 extern const std::string WLP4_REDUCTIONS;
 extern const std::string WLP4_DFA;
 extern const std::string WLP4_COMBINED;
+extern const std::string WLP4_RUNTIME;
 
 #endif
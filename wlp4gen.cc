@@ -4,8 +4,12 @@
 #include <vector>
 #include <cctype>
 #include <map>
+#include <set>
 #include <deque>
 #include <algorithm>
+#include <chrono>
+#include <functional>
+#include <fstream>
 #include "dfa.h"
 #include "wlp4data.h"
 #include "mipshelper.h"
@@ -493,6 +497,7 @@ struct TreeNode
     Token token;
     Rules rule;
     vector<TreeNode *> children;
+    int counter = -1; // profile counter of the block this node starts
 
     ~TreeNode()
     {
@@ -787,13 +792,32 @@ struct Procedure
     string name;
     vector<string> signature;
     VariableTable localTable;
+    // filled in by analyzeCalls
+    set<string> callees;
+    set<TreeNode *> tailCalls; // self calls compiled as a jump back to the entry
+    bool leaf;                 // makes no jalr at all (no calls, println, new, delete)
+    bool usesFramePointer;     // sets up $29 to reach its params and locals
+    bool clobbersFramePointer; // $29 may differ after a call to it returns
+    map<string, int> registers; // variables kept in a register instead of the frame
+    vector<int> savedRegisters; // callee-saved registers to store in the prologue
+    map<TreeNode *, TreeNode *> bottomTests; // loops walking a pointer -> test repeated after the body
+    vector<TreeNode *> arrays;   // new int[N] factors placed in the frame
+    set<TreeNode *> checkedDeletes; // deletes of a pointer known not to be NULL
+    set<string> deadInitializers;   // locals written before they are ever read
+    map<string, int> constants;     // literals loaded into a register at entry
 
     Procedure()
     {
         name = "";
+        leaf = false;
+        usesFramePointer = true;
+        clobbersFramePointer = true;
     }
     Procedure(TreeNode *root)
     {
+        leaf = false;
+        usesFramePointer = true;
+        clobbersFramePointer = true;
         if (root->rule.lhs == "main")
         {
             name = "wain";
@@ -877,6 +901,11 @@ struct Procedure
 struct ProcedureTable
 {
     map<string, Procedure> procedureMap;
+    int counters = 0;           // profile counters numbered by setUpProfile
+    bool instrument = false;    // count block entries in the generated code
+    bool profiled = false;      // counts holds a profile read with --profile
+    vector<long long> counts;   // times each counter's block was entered
+    bool builtinRuntime = false; // append WLP4_RUNTIME instead of importing it
 
     void add(Procedure method)
     {
@@ -1201,34 +1230,3739 @@ ProcedureTable collectProcedures(TreeNode *start)
     return table;
 }
 
+//// PROFILE ////////////////////////////////////////////////
+// Every procedure body, if arm and loop body gets a counter, numbered in
+// source order before any pass runs so that an instrumented build and a
+// later build reading its profile agree on them. Copies of a block made by
+// the passes share its counter.
+const long long hotCalls = 1000; // call sites run this often inline bigger callees
+
+void assignCounters(TreeNode *root, int &next)
+{
+    if (root->rule.lhs == "procedure" || root->rule.lhs == "main")
+    {
+        root->counter = next++;
+    }
+    if (root->rule.lhs == "statement" && root->rule.rhs[0] == "IF")
+    {
+        getChild(root, "statements", 1)->counter = next++;
+        getChild(root, "statements", 2)->counter = next++;
+    }
+    if (root->rule.lhs == "statement" && root->rule.rhs[0] == "WHILE")
+    {
+        getChild(root, "statements", 1)->counter = next++;
+    }
+    for (auto child : root->children)
+    {
+        assignCounters(child, next);
+    }
+}
+
+// Number the counters and read the profile file, which is the output of a
+// run of the instrumented program: the counts end it, followed by how many
+// there are.
+void setUpProfile(TreeNode *start, ProcedureTable &table, string file)
+{
+    table.counters = 0;
+    assignCounters(start, table.counters);
+    if (file == "")
+    {
+        return;
+    }
+    ifstream in(file);
+    if (!in)
+    {
+        throw runtime_error("ERROR: cannot read profile " + file);
+    }
+    vector<long long> numbers;
+    long long number;
+    while (in >> number)
+    {
+        numbers.push_back(number);
+    }
+    if (numbers.empty() || numbers.back() != table.counters || (long long)numbers.size() < table.counters + 1)
+    {
+        throw runtime_error("ERROR: profile does not match the program");
+    }
+    table.counts.assign(numbers.end() - 1 - table.counters, numbers.end() - 1);
+    table.profiled = true;
+}
+
+// How often the block root starts was entered, or weight, the count of the
+// enclosing block, if it is not a block or there is no profile.
+long long regionWeight(TreeNode *root, ProcedureTable &table, long long weight)
+{
+    if (table.profiled && root->counter >= 0)
+    {
+        return table.counts[root->counter];
+    }
+    return weight;
+}
+
+// Weight of a child of root: a loop test runs once more per entry than
+// the loop body.
+long long childWeight(TreeNode *root, TreeNode *child, ProcedureTable &table, long long weight)
+{
+    if (table.profiled && root->rule.lhs == "statement" && root->rule.rhs[0] == "WHILE" && child->rule.lhs == "test")
+    {
+        return weight + regionWeight(getChild(root, "statements", 1), table, 0);
+    }
+    return weight;
+}
+
+// Uses of each variable weighted by how often their block ran.
+void weighUses(TreeNode *root, Procedure &current, ProcedureTable &table, map<string, long long> &uses, long long weight)
+{
+    weight = regionWeight(root, table, weight);
+    if ((root->rule.lhs == "factor" || root->rule.lhs == "lvalue") && root->rule.rhs.size() == 1 && root->rule.rhs[0] == "ID")
+    {
+        uses[root->children[0]->token.lexeme] += weight;
+    }
+    for (auto child : root->children)
+    {
+        weighUses(child, current, table, uses, childWeight(root, child, table, weight));
+    }
+    if (current.bottomTests.count(root))
+    {
+        TreeNode *bottom = current.bottomTests[root];
+        weighUses(bottom, current, table, uses, childWeight(root, bottom, table, weight));
+    }
+}
+
+//// CALL GRAPH ///////////////////////////////////////////////
+// Strip single-child expr/term/factor wrappers and parentheses.
+TreeNode *innerNode(TreeNode *root)
+{
+    while (true)
+    {
+        if (root->rule.lhs == "expr" && root->rule.rhs[0] == "term")
+        {
+            root = getChild(root, "term", 1);
+        }
+        else if (root->rule.lhs == "lvalue" && root->rule.rhs[0] == "LPAREN")
+        {
+            root = getChild(root, "lvalue", 1);
+        }
+        else if (root->rule.lhs == "term" && root->rule.rhs[0] == "factor")
+        {
+            root = getChild(root, "factor", 1);
+        }
+        else if (root->rule.lhs == "factor" && root->rule.rhs[0] == "LPAREN")
+        {
+            root = getChild(root, "expr", 1);
+        }
+        else
+        {
+            return root;
+        }
+    }
+}
+
+// Return the ID, NUM or NULL factor underneath an expression, or nullptr if
+// the expression is compound.
+TreeNode *simpleFactor(TreeNode *root)
+{
+    root = innerNode(root);
+    if (root->rule.lhs == "factor" && root->rule.rhs.size() == 1)
+    {
+        return root;
+    }
+    return nullptr;
+}
+
+bool isConstFactor(TreeNode *factor)
+{
+    return factor != nullptr && (factor->rule.rhs[0] == "NUM" || factor->rule.rhs[0] == "NULL");
+}
+
+// Value of a NUM operand, or false if the operand is not a constant.
+bool constantOperand(TreeNode *root, long long &value)
+{
+    TreeNode *factor = simpleFactor(root);
+    if (factor == nullptr || factor->rule.rhs[0] != "NUM")
+    {
+        return false;
+    }
+    value = stoll(getChild(factor, "NUM", 1)->token.lexeme);
+    return value <= 2147483647;
+}
+
+bool isCall(TreeNode *root)
+{
+    return root->rule.lhs == "factor" && root->rule.rhs.front() == "ID" && root->rule.rhs.back() == "RPAREN";
+}
+
+// Check whether evaluating the subtree may call a procedure.
+bool hasCall(TreeNode *root)
+{
+    if (isCall(root))
+    {
+        return true;
+    }
+    for (auto child : root->children)
+    {
+        if (hasCall(child))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Check whether evaluating the subtree may call a procedure or allocate.
+bool hasSideEffects(TreeNode *root)
+{
+    if (root->tokenvrule == "token" && root->token.kind == "NEW")
+    {
+        return true;
+    }
+    if (isCall(root))
+    {
+        return true;
+    }
+    for (auto child : root->children)
+    {
+        if (hasSideEffects(child))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Count the calls to a procedure in the subtree.
+int countCalls(TreeNode *root, string name)
+{
+    int count = isCall(root) && getChild(root, "ID", 1)->token.lexeme == name ? 1 : 0;
+    for (auto child : root->children)
+    {
+        count += countCalls(child, name);
+    }
+    return count;
+}
+
+// Whether the subtree takes the address of a variable with &.
+bool takesAddress(TreeNode *root)
+{
+    if (root->rule.lhs == "factor" && root->rule.rhs[0] == "AMP")
+    {
+        return true;
+    }
+    for (auto child : root->children)
+    {
+        if (takesAddress(child))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Self calls whose result is returned unchanged: the return expression itself,
+// or "x = self(...);" as the last statement on a path to "return x;".
+void findTailStatement(TreeNode *statements, string name, string result, set<TreeNode *> &tailCalls)
+{
+    if (statements->rule.rhs.empty())
+    {
+        return;
+    }
+    TreeNode *statement = getChild(statements, "statement", 1);
+    if (statement->rule.rhs[0] == "IF")
+    {
+        findTailStatement(getChild(statement, "statements", 1), name, result, tailCalls);
+        findTailStatement(getChild(statement, "statements", 2), name, result, tailCalls);
+    }
+    else if (statement->rule.rhs[0] == "lvalue" && result != "")
+    {
+        TreeNode *target = innerNode(getChild(statement, "lvalue", 1));
+        TreeNode *value = innerNode(getChild(statement, "expr", 1));
+        if (target->rule.rhs[0] == "ID" && getChild(target, "ID", 1)->token.lexeme == result && isCall(value) && getChild(value, "ID", 1)->token.lexeme == name)
+        {
+            tailCalls.insert(value);
+        }
+    }
+}
+
+void findTailCalls(TreeNode *method, string name, set<TreeNode *> &tailCalls)
+{
+    TreeNode *value = innerNode(getChild(method, "expr", 1));
+    if (isCall(value))
+    {
+        if (getChild(value, "ID", 1)->token.lexeme == name)
+        {
+            tailCalls.insert(value);
+        }
+        return;
+    }
+    string result = "";
+    if (value->rule.lhs == "factor" && value->rule.rhs.size() == 1 && value->rule.rhs[0] == "ID")
+    {
+        result = getChild(value, "ID", 1)->token.lexeme;
+    }
+    findTailStatement(getChild(method, "statements", 1), name, result, tailCalls);
+}
+
+// Collect the procedures called anywhere in the subtree.
+void collectCallees(TreeNode *root, set<string> &callees)
+{
+    if (isCall(root))
+    {
+        callees.insert(getChild(root, "ID", 1)->token.lexeme);
+    }
+    for (auto child : root->children)
+    {
+        collectCallees(child, callees);
+    }
+}
+
+// Check whether the subtree calls into the runtime (print, new or delete).
+bool usesRuntime(TreeNode *root, Procedure &current)
+{
+    if (find(current.arrays.begin(), current.arrays.end(), root) != current.arrays.end())
+    {
+        return false;
+    }
+    if (root->tokenvrule == "token")
+    {
+        return root->token.kind == "PRINTLN" || root->token.kind == "NEW" || root->token.kind == "DELETE";
+    }
+    for (auto child : root->children)
+    {
+        if (usesRuntime(child, current))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Work out the calling convention details of every procedure: leaf procedures
+// never save $31 and address their variables off $30 without a frame pointer,
+// and callers only preserve $29 around calls that may clobber it.
+void allocateRegisters(TreeNode *method, Procedure &current, ProcedureTable &table);
+
+void analyzeCalls(TreeNode *start, ProcedureTable &table)
+{
+    start = getChild(start, "procedures", 1);
+    while (true)
+    {
+        TreeNode *method = start->rule.rhs[0] == "main" ? getChild(start, "main", 1) : getChild(start, "procedure", 1);
+        string name = method->rule.lhs == "main" ? "wain" : getChild(method, "ID", 1)->token.lexeme;
+        Procedure &current = table.procedureMap[name];
+        current.callees.clear();
+        current.tailCalls.clear();
+        collectCallees(method, current.callees);
+        // a jump back reuses the frame, so nothing may still point into it
+        if (method->rule.lhs == "procedure" && !takesAddress(method) && current.arrays.empty())
+        {
+            findTailCalls(method, name, current.tailCalls);
+            // a procedure only calling itself in tail position makes no real call
+            if ((int)current.tailCalls.size() == countCalls(method, name))
+            {
+                current.callees.erase(name);
+            }
+        }
+        // wain always calls init
+        current.leaf = current.callees.empty() && !usesRuntime(method, current) && method->rule.lhs != "main";
+        allocateRegisters(method, current, table);
+        current.usesFramePointer = !current.leaf && current.registers.size() < current.localTable.varMap.size();
+        current.clobbersFramePointer = current.usesFramePointer;
+        if (start->rule.rhs[0] == "main")
+        {
+            break;
+        }
+        start = getChild(start, "procedures", 1);
+    }
+
+    // a procedure without a frame pointer still clobbers $29 if a callee does
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto &entry : table.procedureMap)
+        {
+            Procedure &current = entry.second;
+            if (current.name == "" || current.clobbersFramePointer)
+            {
+                continue;
+            }
+            for (auto callee : current.callees)
+            {
+                if (table.procedureMap[callee].clobbersFramePointer)
+                {
+                    current.clobbersFramePointer = true;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// Remove procedures that cannot be reached from wain, returning their names
+// in program order.
+vector<string> removeDeadProcedures(TreeNode *start, ProcedureTable &table)
+{
+    map<string, set<string>> callees;
+    TreeNode *procedures = getChild(start, "procedures", 1);
+    while (procedures->rule.rhs[0] == "procedure")
+    {
+        TreeNode *method = getChild(procedures, "procedure", 1);
+        collectCallees(method, callees[getChild(method, "ID", 1)->token.lexeme]);
+        procedures = getChild(procedures, "procedures", 1);
+    }
+    collectCallees(getChild(procedures, "main", 1), callees["wain"]);
+
+    set<string> reachable;
+    vector<string> work = {"wain"};
+    while (!work.empty())
+    {
+        string next = work.back();
+        work.pop_back();
+        if (reachable.insert(next).second)
+        {
+            work.insert(work.end(), callees[next].begin(), callees[next].end());
+        }
+    }
+
+    vector<string> removed;
+    procedures = getChild(start, "procedures", 1);
+    while (procedures->rule.rhs[0] == "procedure")
+    {
+        TreeNode *method = getChild(procedures, "procedure", 1);
+        string name = getChild(method, "ID", 1)->token.lexeme;
+        if (reachable.count(name))
+        {
+            procedures = getChild(procedures, "procedures", 1);
+            continue;
+        }
+        // splice the rest of the chain into this node
+        TreeNode *rest = getChild(procedures, "procedures", 1);
+        procedures->rule = rest->rule;
+        procedures->children = rest->children;
+        rest->children.clear();
+        delete rest;
+        delete method;
+        table.procedureMap.erase(name);
+        removed.push_back(name);
+    }
+    return removed;
+}
+
+//// INLINING ///////////////////////////////////////////////
+TreeNode *makeToken(string kind, string lexeme)
+{
+    TreeNode *node = new TreeNode;
+    node->tokenvrule = "token";
+    node->token = Token{kind, lexeme};
+    return node;
+}
+
+TreeNode *makeRule(string lhs, vector<TreeNode *> children, string type)
+{
+    TreeNode *node = new TreeNode;
+    node->tokenvrule = "rule";
+    node->rule.lhs = lhs;
+    for (auto child : children)
+    {
+        node->rule.rhs.push_back(child->tokenvrule == "token" ? child->token.kind : child->rule.lhs);
+    }
+    node->children = children;
+    node->type = type;
+    return node;
+}
+
+TreeNode *cloneTree(TreeNode *root)
+{
+    TreeNode *node = new TreeNode;
+    node->tokenvrule = root->tokenvrule;
+    node->type = root->type;
+    node->token = root->token;
+    node->rule = root->rule;
+    node->counter = root->counter;
+    for (auto child : root->children)
+    {
+        node->children.push_back(cloneTree(child));
+    }
+    return node;
+}
+
+int treeSize(TreeNode *root)
+{
+    int size = 1;
+    for (auto child : root->children)
+    {
+        size += treeSize(child);
+    }
+    return size;
+}
+
+// Overwrite a node with the contents of another one, which is consumed.
+void replaceNode(TreeNode *root, TreeNode *replacement)
+{
+    for (auto child : root->children)
+    {
+        delete child;
+    }
+    root->tokenvrule = replacement->tokenvrule;
+    root->type = replacement->type;
+    root->token = replacement->token;
+    root->rule = replacement->rule;
+    root->children = replacement->children;
+    replacement->children.clear();
+    delete replacement;
+}
+
+// NUM or NULL factor holding the initial value of a declaration.
+TreeNode *makeConstFactor(TreeNode *dcls)
+{
+    if (dcls->children[3]->token.kind == "NULL")
+    {
+        return makeRule("factor", {makeToken("NULL", "NULL")}, "int*");
+    }
+    return makeRule("factor", {makeToken("NUM", dcls->children[3]->token.lexeme)}, "int");
+}
+
+TreeNode *makeFactorExpr(TreeNode *factor)
+{
+    return makeRule("expr", {makeRule("term", {factor}, factor->type)}, factor->type);
+}
+
+TreeNode *makeAssign(string name, string type, TreeNode *expr)
+{
+    TreeNode *lvalue = makeRule("lvalue", {makeToken("ID", name)}, type);
+    return makeRule("statement", {lvalue, makeToken("BECOMES", "="), expr, makeToken("SEMI", ";")}, "");
+}
+
+vector<TreeNode *> statementList(TreeNode *statements)
+{
+    vector<TreeNode *> list;
+    while (!statements->rule.rhs.empty())
+    {
+        list.push_back(getChild(statements, "statement", 1));
+        statements = getChild(statements, "statements", 1);
+    }
+    reverse(list.begin(), list.end());
+    return list;
+}
+
+// Rebuild a statements chain from a list, keeping the root node so the
+// parent's pointer stays valid. The statements themselves are reused.
+void setStatements(TreeNode *statements, vector<TreeNode *> list)
+{
+    TreeNode *chain = statements;
+    while (true)
+    {
+        TreeNode *next = chain->rule.rhs.empty() ? nullptr : getChild(chain, "statements", 1);
+        chain->children.clear();
+        if (chain != statements)
+        {
+            delete chain;
+        }
+        if (next == nullptr)
+        {
+            break;
+        }
+        chain = next;
+    }
+    chain = makeRule("statements", {}, "");
+    for (int i = 0; i + 1 < (int)list.size(); i++)
+    {
+        chain = makeRule("statements", {chain, list[i]}, "");
+    }
+    statements->rule.rhs.clear();
+    statements->children.clear();
+    if (list.empty())
+    {
+        delete chain;
+        return;
+    }
+    statements->rule.rhs = {"statements", "statement"};
+    statements->children = {chain, list.back()};
+}
+
+// Declarations of a dcls chain in declaration order.
+vector<TreeNode *> dclsList(TreeNode *dcls)
+{
+    vector<TreeNode *> list;
+    while (!dcls->rule.rhs.empty())
+    {
+        list.push_back(dcls);
+        dcls = getChild(dcls, "dcls", 1);
+    }
+    reverse(list.begin(), list.end());
+    return list;
+}
+
+vector<TreeNode *> paramList(TreeNode *method)
+{
+    vector<TreeNode *> list;
+    TreeNode *params = getChild(method, "params", 1);
+    if (params->rule.rhs.empty())
+    {
+        return list;
+    }
+    params = getChild(params, "paramlist", 1);
+    while (true)
+    {
+        list.push_back(getChild(params, "dcl", 1));
+        if (params->children.size() == 1)
+        {
+            return list;
+        }
+        params = getChild(params, "paramlist", 1);
+    }
+}
+
+vector<TreeNode *> argList(TreeNode *call)
+{
+    vector<TreeNode *> list;
+    if (call->rule.rhs.size() == 3)
+    {
+        return list;
+    }
+    TreeNode *arglist = getChild(call, "arglist", 1);
+    while (true)
+    {
+        list.push_back(getChild(arglist, "expr", 1));
+        if (arglist->children.size() == 1)
+        {
+            return list;
+        }
+        arglist = arglist->children[2];
+    }
+}
+
+string dclName(TreeNode *dcl)
+{
+    return dcl->children[1]->token.lexeme;
+}
+
+string dclType(TreeNode *dcl)
+{
+    return dcl->children[0]->children.size() == 1 ? "int" : "int*";
+}
+
+// Count the uses of a variable as a factor or lvalue in the subtree.
+int countUses(TreeNode *root, string name)
+{
+    int count = 0;
+    if ((root->rule.lhs == "factor" || root->rule.lhs == "lvalue") && root->rule.rhs.size() == 1 && root->rule.rhs[0] == "ID" && root->children[0]->token.lexeme == name)
+    {
+        count++;
+    }
+    for (auto child : root->children)
+    {
+        count += countUses(child, name);
+    }
+    return count;
+}
+
+// Variables whose address is taken with & somewhere in the subtree.
+void collectAddressTaken(TreeNode *root, set<string> &names)
+{
+    if (root->rule.lhs == "factor" && root->rule.rhs[0] == "AMP")
+    {
+        TreeNode *target = innerNode(getChild(root, "lvalue", 1));
+        if (target->rule.rhs[0] == "ID")
+        {
+            names.insert(getChild(target, "ID", 1)->token.lexeme);
+        }
+    }
+    for (auto child : root->children)
+    {
+        collectAddressTaken(child, names);
+    }
+}
+
+// Rename variable references in a cloned subtree; procedure names in calls
+// are left alone since only single-token factors and lvalues are touched.
+void renameVariables(TreeNode *root, map<string, string> &names)
+{
+    if ((root->rule.lhs == "factor" || root->rule.lhs == "lvalue") && root->rule.rhs.size() == 1 && root->rule.rhs[0] == "ID" && names.count(root->children[0]->token.lexeme))
+    {
+        root->children[0]->token.lexeme = names[root->children[0]->token.lexeme];
+    }
+    for (auto child : root->children)
+    {
+        renameVariables(child, names);
+    }
+}
+
+// Replace variable factors with copies of the given expressions.
+void substituteVariables(TreeNode *root, map<string, TreeNode *> &values)
+{
+    if (root->rule.lhs == "factor" && root->rule.rhs.size() == 1 && root->rule.rhs[0] == "ID" && values.count(root->children[0]->token.lexeme))
+    {
+        TreeNode *value = values[root->children[0]->token.lexeme];
+        TreeNode *factor = simpleFactor(value);
+        if (factor != nullptr)
+        {
+            replaceNode(root, cloneTree(factor));
+        }
+        else
+        {
+            replaceNode(root, makeRule("factor", {makeToken("LPAREN", "("), cloneTree(value), makeToken("RPAREN", ")")}, value->type));
+        }
+        return;
+    }
+    for (auto child : root->children)
+    {
+        substituteVariables(child, values);
+    }
+}
+
+struct Inliner
+{
+    ProcedureTable *table;
+    map<string, TreeNode *> methods; // procedure name -> procedure node
+    map<string, int> callSites;
+    set<string> recursive;
+    map<TreeNode *, long long> frequency; // call -> times it ran, with a profile
+    int budget;  // tree nodes the inliner may still add to the program
+    int counter; // for fresh variable names
+
+    // tree nodes in a callee body
+    int bodySize(TreeNode *method)
+    {
+        return treeSize(getChild(method, "dcls", 1)) + treeSize(getChild(method, "statements", 1)) + treeSize(getChild(method, "expr", 1));
+    }
+
+    bool canInline(string caller, TreeNode *call, int limit)
+    {
+        string callee = getChild(call, "ID", 1)->token.lexeme;
+        if (callee == caller || recursive.count(callee) || !methods.count(callee))
+        {
+            return false;
+        }
+        int size = bodySize(methods[callee]);
+        // calls the profile never saw run gain nothing, hot ones more
+        if (frequency.count(call) && frequency[call] == 0)
+        {
+            limit = 0;
+        }
+        else if (frequency.count(call) && frequency[call] >= hotCalls)
+        {
+            limit *= 2;
+        }
+        // a procedure with one call site can be absorbed whole
+        return size <= budget && (size <= limit || callSites[callee] == 1);
+    }
+};
+
+string freshName(Inliner &inliner, Procedure &caller, string name)
+{
+    string fresh;
+    do
+    {
+        fresh = name + "I" + to_string(inliner.counter++);
+    } while (caller.localTable.varMap.count(fresh) || inliner.table->procedureMap.count(fresh));
+    return fresh;
+}
+
+// Add "type name = NULL/0;" to the caller's declarations.
+// Append a declaration "dcl = value;" to the locals of a procedure.
+void appendDcls(TreeNode *method, TreeNode *dcl, TreeNode *value)
+{
+    TreeNode *dcls = getChild(method, "dcls", 1);
+    TreeNode *inner = makeRule("dcls", dcls->children, "");
+    inner->rule = dcls->rule;
+    dcls->children.clear();
+    replaceNode(dcls, makeRule("dcls", {inner, dcl, makeToken("BECOMES", "="), value, makeToken("SEMI", ";")}, ""));
+}
+
+void addLocal(TreeNode *method, Procedure &caller, string name, string type)
+{
+    TreeNode *typeNode = type == "int" ? makeRule("type", {makeToken("INT", "int")}, "") : makeRule("type", {makeToken("INT", "int"), makeToken("STAR", "*")}, "");
+    TreeNode *dcl = makeRule("dcl", {typeNode, makeToken("ID", name)}, "");
+    appendDcls(method, dcl, type == "int" ? makeToken("NUM", "0") : makeToken("NULL", "NULL"));
+    Variable var;
+    var.name = name;
+    var.type = type;
+    caller.localTable.add(var);
+}
+
+// Expression form: a callee that is a single return expression is
+// substituted directly when doing so cannot reorder side effects.
+bool inlineExpression(Inliner &inliner, TreeNode *call, string caller, set<string> &addressTaken)
+{
+    string callee = getChild(call, "ID", 1)->token.lexeme;
+    if (!inliner.canInline(caller, call, 40))
+    {
+        return false;
+    }
+    TreeNode *method = inliner.methods[callee];
+    TreeNode *body = getChild(method, "expr", 1);
+    set<string> calleeAddressTaken;
+    collectAddressTaken(body, calleeAddressTaken);
+    if (!getChild(method, "statements", 1)->rule.rhs.empty() || !calleeAddressTaken.empty())
+    {
+        return false;
+    }
+    vector<TreeNode *> params = paramList(method);
+    vector<TreeNode *> args = argList(call);
+    bool pure = !hasSideEffects(body);
+    for (auto arg : args)
+    {
+        pure = pure && !hasSideEffects(arg);
+    }
+    map<string, TreeNode *> values;
+    for (int i = 0; i < (int)params.size(); i++)
+    {
+        TreeNode *factor = simpleFactor(args[i]);
+        int uses = countUses(body, dclName(params[i]));
+        if (isConstFactor(factor) || pure)
+        {
+            // constants never change; with no side effects anywhere a value
+            // is the same whether it is read before the body or inside it
+            if (factor == nullptr && uses > 1)
+            {
+                return false;
+            }
+        }
+        else if (factor == nullptr || addressTaken.count(getChild(factor, "ID", 1)->token.lexeme))
+        {
+            return false;
+        }
+        values[dclName(params[i])] = args[i];
+    }
+    TreeNode *dcls = getChild(method, "dcls", 1);
+    vector<TreeNode *> constants;
+    for (auto local : dclsList(dcls))
+    {
+        constants.push_back(makeFactorExpr(makeConstFactor(local)));
+        values[dclName(getChild(local, "dcl", 1))] = constants.back();
+    }
+    TreeNode *copy = cloneTree(body);
+    substituteVariables(copy, values);
+    for (auto constant : constants)
+    {
+        delete constant;
+    }
+    inliner.budget -= inliner.bodySize(method);
+    replaceNode(call, makeRule("factor", {makeToken("LPAREN", "("), copy, makeToken("RPAREN", ")")}, "int"));
+    return true;
+}
+
+void inlineExpressions(Inliner &inliner, TreeNode *root, string caller, set<string> &addressTaken)
+{
+    for (auto child : root->children)
+    {
+        inlineExpressions(inliner, child, caller, addressTaken);
+    }
+    if (isCall(root))
+    {
+        inlineExpression(inliner, root, caller, addressTaken);
+    }
+}
+
+// Statement form: the callee's params and locals become fresh caller locals,
+// assigned in argument order, followed by the renamed body.
+vector<TreeNode *> expandCall(Inliner &inliner, TreeNode *call, TreeNode *callerMethod, Procedure &caller, TreeNode *&result)
+{
+    string callee = getChild(call, "ID", 1)->token.lexeme;
+    TreeNode *method = inliner.methods[callee];
+    inliner.budget -= inliner.bodySize(method);
+    map<string, string> names;
+    vector<TreeNode *> list;
+    vector<TreeNode *> params = paramList(method);
+    vector<TreeNode *> args = argList(call);
+    for (int i = 0; i < (int)params.size(); i++)
+    {
+        string fresh = freshName(inliner, caller, dclName(params[i]));
+        names[dclName(params[i])] = fresh;
+        addLocal(callerMethod, caller, fresh, dclType(params[i]));
+        list.push_back(makeAssign(fresh, dclType(params[i]), cloneTree(args[i])));
+    }
+    for (auto local : dclsList(getChild(method, "dcls", 1)))
+    {
+        TreeNode *dcl = getChild(local, "dcl", 1);
+        string fresh = freshName(inliner, caller, dclName(dcl));
+        names[dclName(dcl)] = fresh;
+        addLocal(callerMethod, caller, fresh, dclType(dcl));
+        list.push_back(makeAssign(fresh, dclType(dcl), makeFactorExpr(makeConstFactor(local))));
+    }
+    for (auto statement : statementList(getChild(method, "statements", 1)))
+    {
+        list.push_back(cloneTree(statement));
+        renameVariables(list.back(), names);
+    }
+    result = cloneTree(getChild(method, "expr", 1));
+    renameVariables(result, names);
+    return list;
+}
+
+void inlineStatements(Inliner &inliner, TreeNode *statements, TreeNode *callerMethod, Procedure &caller, set<string> &addressTaken)
+{
+    vector<TreeNode *> list;
+    for (auto statement : statementList(statements))
+    {
+        if (statement->rule.rhs[0] == "IF")
+        {
+            inlineExpressions(inliner, getChild(statement, "test", 1), caller.name, addressTaken);
+            inlineStatements(inliner, getChild(statement, "statements", 1), callerMethod, caller, addressTaken);
+            inlineStatements(inliner, getChild(statement, "statements", 2), callerMethod, caller, addressTaken);
+        }
+        else if (statement->rule.rhs[0] == "WHILE")
+        {
+            inlineExpressions(inliner, getChild(statement, "test", 1), caller.name, addressTaken);
+            inlineStatements(inliner, getChild(statement, "statements", 1), callerMethod, caller, addressTaken);
+        }
+        else if ((statement->rule.rhs[0] == "PRINTLN" || (statement->rule.rhs[0] == "lvalue" && innerNode(getChild(statement, "lvalue", 1))->rule.rhs[0] == "ID")) && isCall(innerNode(getChild(statement, "expr", 1))))
+        {
+            TreeNode *call = innerNode(getChild(statement, "expr", 1));
+            inlineExpressions(inliner, call, caller.name, addressTaken);
+            if (isCall(call) && !inlineExpression(inliner, call, caller.name, addressTaken) && inliner.canInline(caller.name, call, 150))
+            {
+                TreeNode *result = nullptr;
+                for (auto expanded : expandCall(inliner, call, callerMethod, caller, result))
+                {
+                    list.push_back(expanded);
+                }
+                // x = f(...) becomes x = <callee return expression>, and
+                // println(f(...)) prints it
+                replaceNode(getChild(statement, "expr", 1), result);
+            }
+        }
+        else
+        {
+            inlineExpressions(inliner, statement, caller.name, addressTaken);
+        }
+        list.push_back(statement);
+    }
+    setStatements(statements, list);
+}
+
+void inlineProcedure(Inliner &inliner, TreeNode *method, Procedure &caller)
+{
+    set<string> addressTaken;
+    collectAddressTaken(method, addressTaken);
+    TreeNode *statements = getChild(method, "statements", 1);
+    inlineStatements(inliner, statements, method, caller, addressTaken);
+    TreeNode *expr = getChild(method, "expr", 1);
+    inlineExpressions(inliner, expr, caller.name, addressTaken);
+    TreeNode *call = innerNode(expr);
+    if (isCall(call) && inliner.canInline(caller.name, call, 150))
+    {
+        // return f(...) appends the callee body and returns its expression
+        TreeNode *result = nullptr;
+        vector<TreeNode *> list = statementList(statements);
+        for (auto expanded : expandCall(inliner, call, method, caller, result))
+        {
+            list.push_back(expanded);
+        }
+        setStatements(statements, list);
+        replaceNode(expr, result);
+    }
+}
+
+// Times each call ran, from the count of the block it is in.
+void collectCallFrequencies(TreeNode *root, ProcedureTable &table, map<TreeNode *, long long> &frequency, long long weight)
+{
+    weight = regionWeight(root, table, weight);
+    if (isCall(root))
+    {
+        frequency[root] = weight;
+    }
+    for (auto child : root->children)
+    {
+        collectCallFrequencies(child, table, frequency, childWeight(root, child, table, weight));
+    }
+}
+
+// Inline small non-recursive procedures into their callers. Procedures are
+// processed in order, so callees have already been inlined into themselves.
+void inlineProcedures(TreeNode *start, ProcedureTable &table)
+{
+    Inliner inliner;
+    inliner.table = &table;
+    inliner.counter = 0;
+    inliner.budget = treeSize(start) / 2 + 200;
+    if (table.profiled)
+    {
+        collectCallFrequencies(start, table, inliner.frequency, 0);
+    }
+
+    map<string, set<string>> callees;
+    TreeNode *procedures = getChild(start, "procedures", 1);
+    while (procedures->rule.rhs[0] == "procedure")
+    {
+        TreeNode *method = getChild(procedures, "procedure", 1);
+        string name = getChild(method, "ID", 1)->token.lexeme;
+        inliner.methods[name] = method;
+        collectCallees(method, callees[name]);
+        procedures = getChild(procedures, "procedures", 1);
+    }
+    collectCallees(getChild(procedures, "main", 1), callees["wain"]);
+    for (auto &entry : callees)
+    {
+        for (auto callee : entry.second)
+        {
+            inliner.callSites[callee] += countCalls(entry.first == "wain" ? getChild(procedures, "main", 1) : inliner.methods[entry.first], callee);
+        }
+    }
+    // a procedure is recursive if it can reach itself through the call graph
+    for (auto &entry : inliner.methods)
+    {
+        set<string> seen;
+        vector<string> work(callees[entry.first].begin(), callees[entry.first].end());
+        while (!work.empty())
+        {
+            string next = work.back();
+            work.pop_back();
+            if (next == entry.first)
+            {
+                inliner.recursive.insert(entry.first);
+                break;
+            }
+            if (seen.insert(next).second)
+            {
+                work.insert(work.end(), callees[next].begin(), callees[next].end());
+            }
+        }
+    }
+
+    procedures = getChild(start, "procedures", 1);
+    while (procedures->rule.rhs[0] == "procedure")
+    {
+        TreeNode *method = getChild(procedures, "procedure", 1);
+        inlineProcedure(inliner, method, table.procedureMap[getChild(method, "ID", 1)->token.lexeme]);
+        procedures = getChild(procedures, "procedures", 1);
+    }
+    inlineProcedure(inliner, getChild(procedures, "main", 1), table.procedureMap["wain"]);
+}
+
+//// VALUE NUMBERING //////////////////////////////////////////
+// Local value numbering over each straight-line run of statements. A value
+// computed twice in a run is assigned to a new local just before the
+// statement that first computes it, and every occurrence reads the local.
+struct Candidate
+{
+    vector<TreeNode *> nodes; // occurrences in evaluation order
+    int statement;            // index of the statement computing it first
+    bool hoistable;           // same value at the start of that statement
+};
+
+struct ValueNumbering
+{
+    map<string, int> numbers;  // expression key -> value number
+    map<string, int> versions; // variable -> assignments seen so far
+    set<string> addressTaken;  // variables that stores through pointers can change
+    int memory;                // bumped by stores, calls, new and delete
+    int memoryAtStatement;
+    int statement;
+    int unique;
+    map<int, Candidate> candidates;
+    vector<int> order; // candidate value numbers, inner ones first
+};
+
+int valueNumber(ValueNumbering &vn, string key)
+{
+    if (!vn.numbers.count(key))
+    {
+        int number = vn.numbers.size();
+        vn.numbers[key] = number;
+    }
+    return vn.numbers[key];
+}
+
+// Number an expression in evaluation order. Binary operations and loads
+// without side effects are recorded as candidates when record is set.
+int numberExpr(TreeNode *root, ValueNumbering &vn, bool record)
+{
+    root = innerNode(root);
+    bool candidate = ((root->rule.lhs == "expr" || root->rule.lhs == "term") && root->rule.rhs.size() == 3) || (root->rule.lhs == "factor" && root->rule.rhs[0] == "STAR");
+    if (candidate && record && !hasSideEffects(root))
+    {
+        int number = numberExpr(root, vn, false);
+        if (vn.candidates.count(number))
+        {
+            vn.candidates[number].nodes.push_back(root);
+            return number;
+        }
+        for (auto child : root->children)
+        {
+            if (child->tokenvrule == "rule")
+            {
+                numberExpr(child, vn, true);
+            }
+        }
+        Candidate &entry = vn.candidates[number];
+        entry.nodes.push_back(root);
+        entry.statement = vn.statement;
+        entry.hoistable = vn.memory == vn.memoryAtStatement;
+        vn.order.push_back(number);
+        return number;
+    }
+
+    if (root->rule.lhs == "factor" && root->rule.rhs[0] == "ID" && root->rule.rhs.size() == 1)
+    {
+        string name = getChild(root, "ID", 1)->token.lexeme;
+        string key = "var " + name + " " + to_string(vn.versions[name]);
+        if (vn.addressTaken.count(name))
+        {
+            key += " " + to_string(vn.memory);
+        }
+        return valueNumber(vn, key);
+    }
+    if (root->rule.rhs[0] == "NUM")
+    {
+        return valueNumber(vn, "num " + getChild(root, "NUM", 1)->token.lexeme);
+    }
+    if (root->rule.rhs[0] == "NULL")
+    {
+        return valueNumber(vn, "null");
+    }
+    if (root->rule.rhs[0] == "AMP")
+    {
+        TreeNode *target = innerNode(getChild(root, "lvalue", 1));
+        if (target->rule.rhs[0] == "ID")
+        {
+            return valueNumber(vn, "address " + getChild(target, "ID", 1)->token.lexeme);
+        }
+        return numberExpr(getChild(target, "factor", 1), vn, record);
+    }
+    if (root->rule.rhs[0] == "STAR")
+    {
+        int address = numberExpr(getChild(root, "factor", 1), vn, record);
+        return valueNumber(vn, "load " + to_string(address) + " " + to_string(vn.memory));
+    }
+    if (root->rule.lhs == "expr" || root->rule.lhs == "term")
+    {
+        TreeNode *left = root->children[0];
+        TreeNode *right = root->children[2];
+        string op = root->children[1]->token.kind;
+        string first = to_string(numberExpr(left, vn, record)) + left->type;
+        string second = to_string(numberExpr(right, vn, record)) + right->type;
+        if ((op == "PLUS" || op == "STAR") && second < first)
+        {
+            swap(first, second);
+        }
+        return valueNumber(vn, op + " " + first + " " + second);
+    }
+
+    // calls and new produce fresh values and may write memory
+    if (root->rule.rhs[0] == "NEW")
+    {
+        numberExpr(getChild(root, "expr", 1), vn, record);
+    }
+    else
+    {
+        for (auto arg : argList(root))
+        {
+            numberExpr(arg, vn, record);
+        }
+    }
+    vn.memory++;
+    return valueNumber(vn, "unique " + to_string(vn.unique++));
+}
+
+// Number one statement; returns false when it ends the run. An if ends it
+// after its test, a loop before its test since that is evaluated again on
+// every iteration.
+bool numberStatement(TreeNode *statement, ValueNumbering &vn)
+{
+    vn.memoryAtStatement = vn.memory;
+    string kind = statement->rule.rhs[0];
+    if (kind == "lvalue")
+    {
+        TreeNode *target = innerNode(getChild(statement, "lvalue", 1));
+        if (target->rule.rhs[0] == "ID")
+        {
+            string name = getChild(target, "ID", 1)->token.lexeme;
+            numberExpr(getChild(statement, "expr", 1), vn, true);
+            vn.versions[name]++;
+            if (vn.addressTaken.count(name))
+            {
+                vn.memory++;
+            }
+        }
+        else
+        {
+            numberExpr(getChild(target, "factor", 1), vn, true);
+            numberExpr(getChild(statement, "expr", 1), vn, true);
+            vn.memory++;
+        }
+    }
+    else if (kind == "PRINTLN")
+    {
+        numberExpr(getChild(statement, "expr", 1), vn, true);
+    }
+    else if (kind == "DELETE")
+    {
+        numberExpr(getChild(statement, "expr", 1), vn, true);
+        vn.memory++;
+    }
+    else if (kind == "IF")
+    {
+        TreeNode *test = getChild(statement, "test", 1);
+        numberExpr(getChild(test, "expr", 1), vn, true);
+        numberExpr(getChild(test, "expr", 2), vn, true);
+        return false;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Name for a new local of current that clashes with no variable or procedure.
+string freshLocal(Procedure &current, ProcedureTable &table, string prefix)
+{
+    string name;
+    int counter = current.localTable.varMap.size();
+    do
+    {
+        name = prefix + to_string(counter++);
+    } while (current.localTable.varMap.count(name) || table.procedureMap.count(name));
+    return name;
+}
+
+// Replacement for an expr, term or factor that reads a variable.
+TreeNode *makeVariable(string name, string type, string lhs)
+{
+    TreeNode *node = makeRule("factor", {makeToken("ID", name)}, type);
+    if (lhs != "factor")
+    {
+        node = makeRule("term", {node}, type);
+    }
+    if (lhs == "expr")
+    {
+        node = makeRule("expr", {node}, type);
+    }
+    return node;
+}
+
+// Give each value computed more than once in the run its own local.
+void reuseValues(ValueNumbering &vn, TreeNode *method, Procedure &current, ProcedureTable &table, map<int, vector<TreeNode *>> &before)
+{
+    for (auto number : vn.order)
+    {
+        Candidate &entry = vn.candidates[number];
+        if (entry.nodes.size() < 2 || !entry.hoistable)
+        {
+            continue;
+        }
+        TreeNode *value = cloneTree(entry.nodes[0]);
+        string type = value->type;
+        if (value->rule.lhs == "factor")
+        {
+            value = makeFactorExpr(value);
+        }
+        else if (value->rule.lhs == "term")
+        {
+            value = makeRule("expr", {value}, type);
+        }
+        string name = freshLocal(current, table, "value");
+        addLocal(method, current, name, type);
+        before[entry.statement].push_back(makeAssign(name, type, value));
+        for (auto node : entry.nodes)
+        {
+            replaceNode(node, makeVariable(name, type, node->rule.lhs));
+        }
+    }
+    vn.candidates.clear();
+    vn.order.clear();
+}
+
+void numberStatements(TreeNode *statements, TreeNode *returnExpr, TreeNode *method, Procedure &current, ProcedureTable &table, ValueNumbering &vn)
+{
+    vector<TreeNode *> list = statementList(statements);
+    map<int, vector<TreeNode *>> before;
+    for (int i = 0; i < (int)list.size(); i++)
+    {
+        vn.statement = i;
+        if (!numberStatement(list[i], vn))
+        {
+            reuseValues(vn, method, current, table, before);
+        }
+    }
+    if (returnExpr != nullptr)
+    {
+        vn.statement = list.size();
+        vn.memoryAtStatement = vn.memory;
+        numberExpr(returnExpr, vn, true);
+    }
+    reuseValues(vn, method, current, table, before);
+
+    for (auto statement : list)
+    {
+        if (statement->rule.rhs[0] == "IF")
+        {
+            numberStatements(getChild(statement, "statements", 1), nullptr, method, current, table, vn);
+            numberStatements(getChild(statement, "statements", 2), nullptr, method, current, table, vn);
+        }
+        else if (statement->rule.rhs[0] == "WHILE")
+        {
+            numberStatements(getChild(statement, "statements", 1), nullptr, method, current, table, vn);
+        }
+    }
+
+    vector<TreeNode *> result;
+    for (int i = 0; i <= (int)list.size(); i++)
+    {
+        result.insert(result.end(), before[i].begin(), before[i].end());
+        if (i < (int)list.size())
+        {
+            result.push_back(list[i]);
+        }
+    }
+    if (result.size() != list.size())
+    {
+        setStatements(statements, result);
+    }
+}
+
+void numberValues(TreeNode *start, ProcedureTable &table)
+{
+    TreeNode *procedures = getChild(start, "procedures", 1);
+    while (true)
+    {
+        TreeNode *method = procedures->rule.rhs[0] == "main" ? getChild(procedures, "main", 1) : getChild(procedures, "procedure", 1);
+        string name = method->rule.lhs == "main" ? "wain" : getChild(method, "ID", 1)->token.lexeme;
+        ValueNumbering vn;
+        vn.memory = 0;
+        vn.unique = 0;
+        collectAddressTaken(method, vn.addressTaken);
+        numberStatements(getChild(method, "statements", 1), getChild(method, "expr", 1), method, table.procedureMap[name], table, vn);
+        if (method->rule.lhs == "main")
+        {
+            break;
+        }
+        procedures = getChild(procedures, "procedures", 1);
+    }
+}
+
+//// LOOP INVARIANT CODE MOTION ///////////////////////////////
+// What a loop's test and body may change.
+struct LoopEffects
+{
+    set<string> assigned; // variables assigned anywhere in the loop
+    bool writesMemory;    // stores through pointers, address-taken variables, calls, new, delete
+};
+
+void collectEffects(TreeNode *root, set<string> &addressTaken, LoopEffects &effects)
+{
+    if (root->rule.lhs == "statement" && root->rule.rhs[0] == "lvalue")
+    {
+        TreeNode *target = innerNode(getChild(root, "lvalue", 1));
+        if (target->rule.rhs[0] == "ID")
+        {
+            string name = getChild(target, "ID", 1)->token.lexeme;
+            effects.assigned.insert(name);
+            effects.writesMemory = effects.writesMemory || addressTaken.count(name);
+        }
+        else
+        {
+            effects.writesMemory = true;
+        }
+    }
+    if ((root->rule.lhs == "statement" && root->rule.rhs[0] == "DELETE") || hasSideEffects(root))
+    {
+        effects.writesMemory = true;
+    }
+    for (auto child : root->children)
+    {
+        collectEffects(child, addressTaken, effects);
+    }
+}
+
+// Whether an expression reads memory, and whether evaluating it can fault
+// or divide by zero, so it must not run when the loop would not.
+bool readsMemory(TreeNode *root, set<string> &addressTaken)
+{
+    if (root->rule.lhs == "factor" && root->rule.rhs[0] == "STAR")
+    {
+        return true;
+    }
+    if (root->rule.lhs == "factor" && root->rule.rhs.size() == 1 && root->rule.rhs[0] == "ID" && addressTaken.count(root->children[0]->token.lexeme))
+    {
+        return true;
+    }
+    for (auto child : root->children)
+    {
+        if (readsMemory(child, addressTaken))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool mayFault(TreeNode *root)
+{
+    if (root->tokenvrule == "token")
+    {
+        return root->token.kind == "SLASH" || root->token.kind == "PCT";
+    }
+    if (root->rule.lhs == "factor" && root->rule.rhs[0] == "STAR")
+    {
+        return true;
+    }
+    for (auto child : root->children)
+    {
+        if (mayFault(child))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isInvariant(TreeNode *root, set<string> &addressTaken, LoopEffects &effects)
+{
+    if (hasSideEffects(root) || (effects.writesMemory && readsMemory(root, addressTaken)))
+    {
+        return false;
+    }
+    if (root->rule.lhs == "factor" && root->rule.rhs.size() == 1 && root->rule.rhs[0] == "ID" && effects.assigned.count(root->children[0]->token.lexeme))
+    {
+        return false;
+    }
+    for (auto child : root->children)
+    {
+        if (!isInvariant(child, addressTaken, effects))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Source text of an expression, used to share one local between copies.
+string expressionKey(TreeNode *root)
+{
+    if (root->tokenvrule == "token")
+    {
+        return root->token.lexeme + " ";
+    }
+    string key;
+    for (auto child : root->children)
+    {
+        key += expressionKey(child);
+    }
+    return key;
+}
+
+// Collect the largest invariant operations and loads of an expression.
+// unconditional is set when the expression runs on every iteration, which
+// is required for anything that may fault.
+void findInvariants(TreeNode *root, bool unconditional, set<string> &addressTaken, LoopEffects &effects, vector<TreeNode *> &found)
+{
+    root = innerNode(root);
+    bool candidate = ((root->rule.lhs == "expr" || root->rule.lhs == "term") && root->rule.rhs.size() == 3) || (root->rule.lhs == "factor" && root->rule.rhs[0] == "STAR");
+    if (candidate && isInvariant(root, addressTaken, effects) && (unconditional || !mayFault(root)))
+    {
+        found.push_back(root);
+        return;
+    }
+    if (root->rule.lhs == "expr" || root->rule.lhs == "term")
+    {
+        findInvariants(root->children[0], unconditional, addressTaken, effects, found);
+        findInvariants(root->children[2], unconditional, addressTaken, effects, found);
+    }
+    else if (root->rule.lhs == "factor" && (root->rule.rhs[0] == "STAR" || root->rule.rhs[0] == "NEW" || root->rule.rhs[0] == "AMP"))
+    {
+        TreeNode *inner = root->rule.rhs[0] == "NEW" ? getChild(root, "expr", 1) : root->rule.rhs[0] == "STAR" ? getChild(root, "factor", 1) : innerNode(getChild(root, "lvalue", 1));
+        if (inner->rule.lhs == "lvalue")
+        {
+            if (inner->rule.rhs[0] == "STAR")
+            {
+                findInvariants(getChild(inner, "factor", 1), unconditional, addressTaken, effects, found);
+            }
+            return;
+        }
+        findInvariants(inner, unconditional, addressTaken, effects, found);
+    }
+    else if (isCall(root))
+    {
+        for (auto arg : argList(root))
+        {
+            findInvariants(arg, unconditional, addressTaken, effects, found);
+        }
+    }
+}
+
+void findStatementInvariants(TreeNode *statements, bool unconditional, set<string> &addressTaken, LoopEffects &effects, vector<TreeNode *> &found)
+{
+    for (auto statement : statementList(statements))
+    {
+        string kind = statement->rule.rhs[0];
+        if (kind == "lvalue")
+        {
+            TreeNode *target = innerNode(getChild(statement, "lvalue", 1));
+            if (target->rule.rhs[0] == "STAR")
+            {
+                findInvariants(getChild(target, "factor", 1), unconditional, addressTaken, effects, found);
+            }
+            findInvariants(getChild(statement, "expr", 1), unconditional, addressTaken, effects, found);
+        }
+        else if (kind == "PRINTLN" || kind == "DELETE")
+        {
+            findInvariants(getChild(statement, "expr", 1), unconditional, addressTaken, effects, found);
+        }
+        else
+        {
+            TreeNode *test = getChild(statement, "test", 1);
+            findInvariants(getChild(test, "expr", 1), unconditional && kind == "IF", addressTaken, effects, found);
+            findInvariants(getChild(test, "expr", 2), unconditional && kind == "IF", addressTaken, effects, found);
+            findStatementInvariants(getChild(statement, "statements", 1), false, addressTaken, effects, found);
+            if (kind == "IF")
+            {
+                findStatementInvariants(getChild(statement, "statements", 2), false, addressTaken, effects, found);
+            }
+        }
+    }
+}
+
+// Move invariant computations of a loop into locals assigned before it.
+// Returns the statements that replace the loop: the assignments and the
+// loop, or an if on the loop test around both when a hoisted computation
+// may fault and so must not run when the loop body would not.
+vector<TreeNode *> hoistInvariants(TreeNode *loop, TreeNode *method, Procedure &current, ProcedureTable &table, set<string> &addressTaken)
+{
+    LoopEffects effects;
+    effects.writesMemory = false;
+    collectEffects(loop, addressTaken, effects);
+    vector<TreeNode *> found;
+    TreeNode *test = getChild(loop, "test", 1);
+    // the guard evaluates the test once more than the loop would, so a test
+    // with side effects keeps anything that may fault inside the loop
+    bool guarded = !hasSideEffects(test);
+    findInvariants(getChild(test, "expr", 1), guarded, addressTaken, effects, found);
+    findInvariants(getChild(test, "expr", 2), guarded, addressTaken, effects, found);
+    findStatementInvariants(getChild(loop, "statements", 1), guarded, addressTaken, effects, found);
+    if (found.empty())
+    {
+        return {loop};
+    }
+
+    TreeNode *guard = nullptr;
+    for (auto node : found)
+    {
+        if (mayFault(node))
+        {
+            guard = cloneTree(test);
+            break;
+        }
+    }
+
+    vector<TreeNode *> result;
+    map<string, string> locals; // expression key -> local holding it
+    for (auto node : found)
+    {
+        string key = expressionKey(node);
+        string type = node->type;
+        if (!locals.count(key))
+        {
+            string name = freshLocal(current, table, "invariant");
+            locals[key] = name;
+            addLocal(method, current, name, type);
+            TreeNode *value = cloneTree(node);
+            if (value->rule.lhs == "factor")
+            {
+                value = makeFactorExpr(value);
+            }
+            else if (value->rule.lhs == "term")
+            {
+                value = makeRule("expr", {value}, type);
+            }
+            result.push_back(makeAssign(locals[key], type, value));
+        }
+        replaceNode(node, makeVariable(locals[key], type, node->rule.lhs));
+    }
+    result.push_back(loop);
+    if (guard == nullptr)
+    {
+        return result;
+    }
+
+    TreeNode *body = makeRule("statements", {}, "");
+    setStatements(body, result);
+    TreeNode *statement = makeRule("statement", {makeToken("IF", "if"), makeToken("LPAREN", "("), guard, makeToken("RPAREN", ")"), makeToken("LBRACE", "{"), body, makeToken("RBRACE", "}"), makeToken("ELSE", "else"), makeToken("LBRACE", "{"), makeRule("statements", {}, ""), makeToken("RBRACE", "}")}, "");
+    return {statement};
+}
+
+// Hoist out of inner loops first so their new assignments can be hoisted
+// again by the loops around them.
+void hoistLoops(TreeNode *statements, TreeNode *method, Procedure &current, ProcedureTable &table, set<string> &addressTaken)
+{
+    vector<TreeNode *> list = statementList(statements);
+    vector<TreeNode *> result;
+    for (auto statement : list)
+    {
+        if (statement->rule.rhs[0] == "IF")
+        {
+            hoistLoops(getChild(statement, "statements", 1), method, current, table, addressTaken);
+            hoistLoops(getChild(statement, "statements", 2), method, current, table, addressTaken);
+        }
+        if (statement->rule.rhs[0] != "WHILE")
+        {
+            result.push_back(statement);
+            continue;
+        }
+        hoistLoops(getChild(statement, "statements", 1), method, current, table, addressTaken);
+        vector<TreeNode *> replacement = hoistInvariants(statement, method, current, table, addressTaken);
+        result.insert(result.end(), replacement.begin(), replacement.end());
+    }
+    if (result != list)
+    {
+        setStatements(statements, result);
+    }
+}
+
+void hoistInvariantCode(TreeNode *start, ProcedureTable &table)
+{
+    TreeNode *procedures = getChild(start, "procedures", 1);
+    while (true)
+    {
+        TreeNode *method = procedures->rule.rhs[0] == "main" ? getChild(procedures, "main", 1) : getChild(procedures, "procedure", 1);
+        string name = method->rule.lhs == "main" ? "wain" : getChild(method, "ID", 1)->token.lexeme;
+        set<string> addressTaken;
+        collectAddressTaken(method, addressTaken);
+        hoistLoops(getChild(method, "statements", 1), method, table.procedureMap[name], table, addressTaken);
+        if (method->rule.lhs == "main")
+        {
+            break;
+        }
+        procedures = getChild(procedures, "procedures", 1);
+    }
+}
+
+//// INDUCTION VARIABLES //////////////////////////////////////
+// An int variable stepped by a constant exactly once per iteration by a
+// top-level statement "i = i + c", "i = c + i" or "i = i - c" of the body.
+struct Induction
+{
+    string name;
+    long long step;
+    TreeNode *update;
+};
+
+int countAssignments(TreeNode *root, string name)
+{
+    int count = 0;
+    if (root->rule.lhs == "statement" && root->rule.rhs[0] == "lvalue")
+    {
+        TreeNode *target = innerNode(getChild(root, "lvalue", 1));
+        if (target->rule.rhs[0] == "ID" && getChild(target, "ID", 1)->token.lexeme == name)
+        {
+            count++;
+        }
+    }
+    for (auto child : root->children)
+    {
+        count += countAssignments(child, name);
+    }
+    return count;
+}
+
+// Name of the variable a factor, term, expr or lvalue names, or "" if it is
+// anything else.
+string variableName(TreeNode *root)
+{
+    TreeNode *inner = innerNode(root);
+    if (inner->rule.lhs == "lvalue")
+    {
+        return inner->rule.rhs[0] == "ID" ? getChild(inner, "ID", 1)->token.lexeme : "";
+    }
+    TreeNode *factor = simpleFactor(root);
+    if (factor == nullptr || factor->rule.rhs[0] != "ID")
+    {
+        return "";
+    }
+    return getChild(factor, "ID", 1)->token.lexeme;
+}
+
+vector<Induction> findInductions(TreeNode *loop, set<string> &addressTaken)
+{
+    vector<Induction> inductions;
+    for (auto statement : statementList(getChild(loop, "statements", 1)))
+    {
+        if (statement->rule.rhs[0] != "lvalue")
+        {
+            continue;
+        }
+        string name = variableName(getChild(statement, "lvalue", 1));
+        TreeNode *value = innerNode(getChild(statement, "expr", 1));
+        if (name == "" || addressTaken.count(name) || getChild(statement, "lvalue", 1)->type != "int" || value->rule.lhs != "expr" || value->rule.rhs.size() != 3)
+        {
+            continue;
+        }
+        long long step;
+        string op = value->children[1]->token.kind;
+        if (variableName(value->children[0]) == name && constantOperand(value->children[2], step))
+        {
+            step = op == "MINUS" ? -step : step;
+        }
+        else if (op == "PLUS" && variableName(value->children[2]) == name && constantOperand(value->children[0], step))
+        {
+        }
+        else
+        {
+            continue;
+        }
+        if (countAssignments(loop, name) == 1)
+        {
+            inductions.push_back(Induction{name, step, statement});
+        }
+    }
+    return inductions;
+}
+
+// Additions of an invariant pointer variable and the induction variable.
+void findPointerSums(TreeNode *root, string induction, set<string> &assigned, vector<TreeNode *> &found)
+{
+    TreeNode *inner = innerNode(root);
+    if (inner->rule.lhs == "expr" && inner->rule.rhs.size() == 3 && inner->children[1]->token.kind == "PLUS" && inner->type == "int*")
+    {
+        TreeNode *left = inner->children[0];
+        TreeNode *right = inner->children[2];
+        string pointer = left->type == "int*" ? variableName(left) : variableName(right);
+        string index = left->type == "int*" ? variableName(right) : variableName(left);
+        if (pointer != "" && index == induction && !assigned.count(pointer))
+        {
+            found.push_back(inner);
+            return;
+        }
+    }
+    for (auto child : root->children)
+    {
+        findPointerSums(child, induction, assigned, found);
+    }
+}
+
+string pointerOf(TreeNode *sum)
+{
+    return sum->children[0]->type == "int*" ? variableName(sum->children[0]) : variableName(sum->children[2]);
+}
+
+// Whether root loads or stores through the address sum.
+bool dereferences(TreeNode *root, TreeNode *sum)
+{
+    if ((root->rule.lhs == "factor" || root->rule.lhs == "lvalue") && !root->rule.rhs.empty() && root->rule.rhs[0] == "STAR" && innerNode(getChild(root, "factor", 1)) == sum)
+    {
+        return true;
+    }
+    for (auto child : root->children)
+    {
+        if (dereferences(child, sum))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether name is read anywhere in root outside the subtree skip.
+bool readOutside(TreeNode *root, TreeNode *skip, string name)
+{
+    if (root == skip)
+    {
+        return false;
+    }
+    if (root->rule.lhs == "factor" && root->rule.rhs.size() == 1 && root->rule.rhs[0] == "ID" && root->children[0]->token.lexeme == name)
+    {
+        return true;
+    }
+    for (auto child : root->children)
+    {
+        if (readOutside(child, skip, name))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+TreeNode *makeBinary(TreeNode *left, string op, TreeNode *right, string type)
+{
+    return makeRule("expr", {left, makeToken(op, op == "PLUS" ? "+" : "-"), right}, type);
+}
+
+// Replace "p + i" in a loop by a pointer that moves with i. When i then only
+// feeds the test "i < n" and is dead after the loop, the loop ends on the
+// pointer reaching p + n instead and i is no longer stepped. That end test
+// is only used at the bottom of the rotated loop: once the guard i < n has
+// passed, every p + i up to p + n is an address the body dereferences, so
+// the unsigned pointer compare cannot wrap.
+// Loops nested in another loop keep stepping i, since the guard reads it
+// again every time the outer loop comes back around.
+vector<TreeNode *> reduceInductions(TreeNode *loop, bool nested, TreeNode *method, Procedure &current, ProcedureTable &table, set<string> &addressTaken)
+{
+    vector<TreeNode *> before;
+    LoopEffects effects;
+    effects.writesMemory = false;
+    collectEffects(loop, addressTaken, effects);
+    TreeNode *body = getChild(loop, "statements", 1);
+
+    for (auto induction : findInductions(loop, addressTaken))
+    {
+        vector<TreeNode *> sums;
+        findPointerSums(loop, induction.name, effects.assigned, sums);
+        if (sums.empty())
+        {
+            continue;
+        }
+
+        // a dereference on every iteration makes the end pointer test safe
+        string endBase;
+        for (auto statement : statementList(body))
+        {
+            for (auto sum : sums)
+            {
+                if (endBase == "" && statement->rule.rhs[0] != "IF" && statement->rule.rhs[0] != "WHILE" && dereferences(statement, sum))
+                {
+                    endBase = pointerOf(sum);
+                }
+            }
+        }
+        TreeNode *test = getChild(loop, "test", 1);
+        TreeNode *limit = simpleFactor(getChild(test, "expr", 2));
+        bool endTest = endBase != "" && !nested && induction.step == 1 && !current.bottomTests.count(loop) && test->rule.rhs[1] == "LT" && variableName(getChild(test, "expr", 1)) == induction.name && !readOutside(method, loop, induction.name);
+        // a limit whose address is taken may also change through a pointer or a call
+        endTest = endTest && limit != nullptr && (limit->rule.rhs[0] == "NUM" || (limit->rule.rhs[0] == "ID" && !effects.assigned.count(variableName(limit)) && !(effects.writesMemory && addressTaken.count(variableName(limit)))));
+
+        map<string, string> pointers; // base pointer -> local walking it
+        vector<TreeNode *> updates;
+        for (auto sum : sums)
+        {
+            string base = pointerOf(sum);
+            if (!pointers.count(base))
+            {
+                pointers[base] = freshLocal(current, table, "walk");
+                addLocal(method, current, pointers[base], "int*");
+                before.push_back(makeAssign(pointers[base], "int*", makeBinary(makeVariable(base, "int*", "expr"), "PLUS", makeVariable(induction.name, "int", "term"), "int*")));
+                TreeNode *step = makeRule("term", {makeRule("factor", {makeToken("NUM", to_string(induction.step < 0 ? -induction.step : induction.step))}, "int")}, "int");
+                updates.push_back(makeAssign(pointers[base], "int*", makeBinary(makeVariable(pointers[base], "int*", "expr"), induction.step < 0 ? "MINUS" : "PLUS", step, "int*")));
+            }
+            replaceNode(sum, makeVariable(pointers[base], "int*", "expr"));
+        }
+
+        // i must have no reads left in the loop besides its update and the test
+        int reads = countUses(loop, induction.name) - countAssignments(loop, induction.name);
+        endTest = endTest && reads == 2;
+        vector<TreeNode *> list;
+        for (auto statement : statementList(body))
+        {
+            if (statement != induction.update || !endTest)
+            {
+                list.push_back(statement);
+            }
+            if (statement == induction.update)
+            {
+                list.insert(list.end(), updates.begin(), updates.end());
+            }
+        }
+        if (endTest)
+        {
+            string end = freshLocal(current, table, "end");
+            addLocal(method, current, end, "int*");
+            before.push_back(makeAssign(end, "int*", makeBinary(makeVariable(endBase, "int*", "expr"), "PLUS", makeRule("term", {cloneTree(limit)}, "int"), "int*")));
+            TreeNode *bottom = makeRule("test", {makeVariable(pointers[endBase], "int*", "expr"), makeToken("LT", "<"), makeVariable(end, "int*", "expr")}, "");
+            current.bottomTests[loop] = bottom;
+            delete induction.update;
+        }
+        setStatements(body, list);
+    }
+    before.push_back(loop);
+    return before;
+}
+
+void reduceLoops(TreeNode *statements, bool nested, TreeNode *method, Procedure &current, ProcedureTable &table, set<string> &addressTaken)
+{
+    vector<TreeNode *> list = statementList(statements);
+    vector<TreeNode *> result;
+    for (auto statement : list)
+    {
+        if (statement->rule.rhs[0] == "IF")
+        {
+            reduceLoops(getChild(statement, "statements", 1), nested, method, current, table, addressTaken);
+            reduceLoops(getChild(statement, "statements", 2), nested, method, current, table, addressTaken);
+        }
+        if (statement->rule.rhs[0] != "WHILE")
+        {
+            result.push_back(statement);
+            continue;
+        }
+        reduceLoops(getChild(statement, "statements", 1), true, method, current, table, addressTaken);
+        vector<TreeNode *> replacement = reduceInductions(statement, nested, method, current, table, addressTaken);
+        result.insert(result.end(), replacement.begin(), replacement.end());
+    }
+    if (result != list)
+    {
+        setStatements(statements, result);
+    }
+}
+
+void reduceInductionVariables(TreeNode *start, ProcedureTable &table)
+{
+    TreeNode *procedures = getChild(start, "procedures", 1);
+    while (true)
+    {
+        TreeNode *method = procedures->rule.rhs[0] == "main" ? getChild(procedures, "main", 1) : getChild(procedures, "procedure", 1);
+        string name = method->rule.lhs == "main" ? "wain" : getChild(method, "ID", 1)->token.lexeme;
+        set<string> addressTaken;
+        collectAddressTaken(method, addressTaken);
+        reduceLoops(getChild(method, "statements", 1), false, method, table.procedureMap[name], table, addressTaken);
+        if (method->rule.lhs == "main")
+        {
+            break;
+        }
+        procedures = getChild(procedures, "procedures", 1);
+    }
+}
+
+//// STACK ARRAYS ///////////////////////////////////////////
+// Arrays of a constant size that never leave their procedure live in its
+// frame: the pointer is assigned once outside any loop and only ever
+// dereferenced, offset by an int, compared or deleted.
+const int maxFrameArray = 256; // words
+
+// Whether root is p, or p offset by int expressions, collecting the offsets.
+bool derivedAddress(TreeNode *root, string name, vector<TreeNode *> &offsets)
+{
+    root = innerNode(root);
+    if (variableName(root) == name && root->rule.lhs == "factor")
+    {
+        return true;
+    }
+    if (root->rule.lhs != "expr" || root->rule.rhs.size() != 3 || root->type != "int*")
+    {
+        return false;
+    }
+    TreeNode *left = root->children[0];
+    TreeNode *right = root->children[2];
+    if (left->type == "int*" && derivedAddress(left, name, offsets))
+    {
+        offsets.push_back(right);
+        return true;
+    }
+    if (right->type == "int*" && root->children[1]->token.kind == "PLUS" && derivedAddress(right, name, offsets))
+    {
+        offsets.push_back(left);
+        return true;
+    }
+    return false;
+}
+
+// Whether the address held in name can leave the procedure or outlive it.
+bool escapes(TreeNode *root, string name)
+{
+    vector<TreeNode *> operands;
+    if (root->rule.lhs == "factor" && root->rule.rhs.size() == 1 && root->rule.rhs[0] == "ID")
+    {
+        return root->children[0]->token.lexeme == name;
+    }
+    if (root->rule.lhs == "factor" && !root->rule.rhs.empty() && root->rule.rhs[0] == "AMP")
+    {
+        TreeNode *target = innerNode(getChild(root, "lvalue", 1));
+        vector<TreeNode *> offsets;
+        if (target->rule.rhs[0] == "STAR" && derivedAddress(getChild(target, "factor", 1), name, offsets))
+        {
+            return true;
+        }
+        operands = {target};
+    }
+    else if ((root->rule.lhs == "factor" || root->rule.lhs == "lvalue") && !root->rule.rhs.empty() && root->rule.rhs[0] == "STAR")
+    {
+        if (!derivedAddress(getChild(root, "factor", 1), name, operands))
+        {
+            operands = {getChild(root, "factor", 1)};
+        }
+    }
+    else if (root->rule.lhs == "test" || (root->rule.lhs == "expr" && root->rule.rhs.size() == 3 && root->children[0]->type == "int*" && root->children[2]->type == "int*"))
+    {
+        // comparisons and pointer differences only read the address
+        for (int side : {0, 2})
+        {
+            if (!derivedAddress(root->children[side], name, operands))
+            {
+                operands.push_back(root->children[side]);
+            }
+        }
+    }
+    else if (root->rule.lhs == "statement" && root->rule.rhs[0] == "DELETE" && variableName(getChild(root, "expr", 1)) == name)
+    {
+        return false;
+    }
+    else
+    {
+        operands = root->children;
+    }
+    for (auto operand : operands)
+    {
+        if (escapes(operand, name))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The top-level "p = new int[N];" statements of a procedure, including those
+// inside ifs, which run at most once per activation.
+void findAllocations(TreeNode *statements, vector<TreeNode *> &found)
+{
+    for (auto statement : statementList(statements))
+    {
+        if (statement->rule.rhs[0] == "IF")
+        {
+            findAllocations(getChild(statement, "statements", 1), found);
+            findAllocations(getChild(statement, "statements", 2), found);
+        }
+        else if (statement->rule.rhs[0] == "lvalue")
+        {
+            TreeNode *value = innerNode(getChild(statement, "expr", 1));
+            if (value->rule.lhs == "factor" && value->rule.rhs[0] == "NEW" && variableName(getChild(statement, "lvalue", 1)) != "")
+            {
+                found.push_back(statement);
+            }
+        }
+    }
+}
+
+// Drop the statements in doomed anywhere in the list.
+void removeStatements(TreeNode *statements, set<TreeNode *> &doomed)
+{
+    vector<TreeNode *> list;
+    vector<TreeNode *> removed;
+    for (auto statement : statementList(statements))
+    {
+        if (doomed.count(statement))
+        {
+            removed.push_back(statement);
+            continue;
+        }
+        if (statement->rule.rhs[0] == "IF")
+        {
+            removeStatements(getChild(statement, "statements", 1), doomed);
+            removeStatements(getChild(statement, "statements", 2), doomed);
+        }
+        else if (statement->rule.rhs[0] == "WHILE")
+        {
+            removeStatements(getChild(statement, "statements", 1), doomed);
+        }
+        list.push_back(statement);
+    }
+    if (!removed.empty())
+    {
+        setStatements(statements, list);
+    }
+    for (auto statement : removed)
+    {
+        delete statement;
+    }
+}
+
+// Collect the "delete [] name;" statements in the subtree.
+void findDeletes(TreeNode *root, string name, set<TreeNode *> &found)
+{
+    if (root->rule.lhs == "statement" && root->rule.rhs[0] == "DELETE" && variableName(getChild(root, "expr", 1)) == name)
+    {
+        found.insert(root);
+    }
+    for (auto child : root->children)
+    {
+        findDeletes(child, name, found);
+    }
+}
+
+void allocateFrameArrays(TreeNode *start, ProcedureTable &table)
+{
+    TreeNode *procedures = getChild(start, "procedures", 1);
+    while (true)
+    {
+        TreeNode *method = procedures->rule.rhs[0] == "main" ? getChild(procedures, "main", 1) : getChild(procedures, "procedure", 1);
+        string name = method->rule.lhs == "main" ? "wain" : getChild(method, "ID", 1)->token.lexeme;
+        Procedure &current = table.procedureMap[name];
+        set<string> addressTaken;
+        collectAddressTaken(method, addressTaken);
+        vector<TreeNode *> allocations;
+        findAllocations(getChild(method, "statements", 1), allocations);
+        for (auto statement : allocations)
+        {
+            string pointer = variableName(getChild(statement, "lvalue", 1));
+            TreeNode *value = innerNode(getChild(statement, "expr", 1));
+            long long words;
+            if (!constantOperand(getChild(value, "expr", 1), words) || words < 1 || words > maxFrameArray)
+            {
+                continue;
+            }
+            if (addressTaken.count(pointer) || countAssignments(method, pointer) != 1 || escapes(method, pointer))
+            {
+                continue;
+            }
+            current.arrays.push_back(value);
+            set<TreeNode *> deletes;
+            findDeletes(method, pointer, deletes);
+            removeStatements(getChild(method, "statements", 1), deletes);
+        }
+        if (method->rule.lhs == "main")
+        {
+            break;
+        }
+        procedures = getChild(procedures, "procedures", 1);
+    }
+}
+
+//// NULL CHECKS ////////////////////////////////////////////
+// Track which pointer variables are known to be NULL or known not to be at
+// each statement. Variables whose address is taken are never tracked, so
+// only assignments to them change what is known.
+enum Nullness
+{
+    MAYBENULL,
+    ISNULL,
+    NOTNULL
+};
+
+typedef map<string, Nullness> NullState; // missing variables may be NULL
+
+struct NullFlow
+{
+    Procedure *current;
+    set<string> addressTaken;
+    map<TreeNode *, Nullness> deletes; // delete statement -> what holds every time
+};
+
+// The variable an address is computed from by adding ints, or "".
+string addressBase(TreeNode *root)
+{
+    root = innerNode(root);
+    if (root->rule.lhs == "expr" && root->rule.rhs.size() == 3 && root->type == "int*")
+    {
+        return addressBase(root->children[0]->type == "int*" ? root->children[0] : root->children[2]);
+    }
+    return root->type == "int*" ? variableName(root) : "";
+}
+
+Nullness nullnessOf(TreeNode *root, NullState &state, NullFlow &flow)
+{
+    root = innerNode(root);
+    if (root->rule.lhs == "factor" && root->rule.rhs[0] == "NULL")
+    {
+        return ISNULL;
+    }
+    if (root->rule.lhs == "factor" && (root->rule.rhs[0] == "AMP" || find(flow.current->arrays.begin(), flow.current->arrays.end(), root) != flow.current->arrays.end()))
+    {
+        return NOTNULL;
+    }
+    if (root->rule.lhs == "factor" && root->rule.rhs.size() == 1 && root->rule.rhs[0] == "ID")
+    {
+        string name = variableName(root);
+        return state.count(name) ? state[name] : MAYBENULL;
+    }
+    // an aligned address plus a multiple of 4 stays aligned, so never NULL
+    if (root->rule.lhs == "expr" && root->rule.rhs.size() == 3 && root->type == "int*")
+    {
+        TreeNode *pointer = root->children[0]->type == "int*" ? root->children[0] : root->children[2];
+        return nullnessOf(pointer, state, flow) == NOTNULL ? NOTNULL : MAYBENULL;
+    }
+    return MAYBENULL;
+}
+
+// Loads and stores through NULL + 4k fault, so any pointer dereferenced in
+// root is not NULL once root has been evaluated. Empty constant-size
+// allocations are folded to NULL along the way.
+void noteDereferences(TreeNode *root, NullState &state, NullFlow &flow)
+{
+    for (auto child : root->children)
+    {
+        noteDereferences(child, state, flow);
+    }
+    long long words;
+    if (root->rule.lhs == "factor" && !root->rule.rhs.empty() && root->rule.rhs[0] == "NEW" && constantOperand(getChild(root, "expr", 1), words) && words < 1)
+    {
+        replaceNode(root, makeRule("factor", {makeToken("NULL", "NULL")}, "int*"));
+    }
+    if ((root->rule.lhs == "factor" || root->rule.lhs == "lvalue") && !root->rule.rhs.empty() && root->rule.rhs[0] == "STAR")
+    {
+        string base = addressBase(getChild(root, "factor", 1));
+        if (base != "" && !flow.addressTaken.count(base))
+        {
+            state[base] = NOTNULL;
+        }
+    }
+}
+
+// What a test being true (or false) says about a "p == NULL" or "p != NULL".
+NullState refineNulls(NullState state, TreeNode *test, bool sense, NullFlow &flow)
+{
+    string kind = test->children[1]->token.kind;
+    if (kind != "EQ" && kind != "NE")
+    {
+        return state;
+    }
+    TreeNode *left = simpleFactor(test->children[0]);
+    TreeNode *right = simpleFactor(test->children[2]);
+    if (left == nullptr || right == nullptr)
+    {
+        return state;
+    }
+    if (left->rule.rhs[0] == "NULL")
+    {
+        swap(left, right);
+    }
+    if (left->rule.rhs[0] == "ID" && left->type == "int*" && right->rule.rhs[0] == "NULL" && !flow.addressTaken.count(variableName(left)))
+    {
+        state[variableName(left)] = (kind == "EQ") == sense ? ISNULL : NOTNULL;
+    }
+    return state;
+}
+
+NullState joinNulls(NullState &a, NullState &b)
+{
+    NullState joined;
+    for (auto &entry : a)
+    {
+        if (b.count(entry.first) && b[entry.first] == entry.second)
+        {
+            joined.insert(entry);
+        }
+    }
+    return joined;
+}
+
+void flowNulls(TreeNode *statements, NullState &state, NullFlow &flow)
+{
+    for (auto statement : statementList(statements))
+    {
+        string kind = statement->rule.rhs[0];
+        if (kind == "lvalue")
+        {
+            noteDereferences(getChild(statement, "expr", 1), state, flow);
+            TreeNode *target = getChild(statement, "lvalue", 1);
+            string name = variableName(target);
+            if (name != "" && target->type == "int*" && !flow.addressTaken.count(name))
+            {
+                state[name] = nullnessOf(getChild(statement, "expr", 1), state, flow);
+            }
+            noteDereferences(target, state, flow);
+        }
+        else if (kind == "IF")
+        {
+            TreeNode *test = getChild(statement, "test", 1);
+            noteDereferences(test, state, flow);
+            NullState taken = refineNulls(state, test, true, flow);
+            NullState skipped = refineNulls(state, test, false, flow);
+            flowNulls(getChild(statement, "statements", 1), taken, flow);
+            flowNulls(getChild(statement, "statements", 2), skipped, flow);
+            state = joinNulls(taken, skipped);
+        }
+        else if (kind == "WHILE")
+        {
+            // iterate until the state at the test stops losing facts
+            TreeNode *test = getChild(statement, "test", 1);
+            NullState head = state;
+            while (true)
+            {
+                NullState body = head;
+                noteDereferences(test, body, flow);
+                body = refineNulls(body, test, true, flow);
+                flowNulls(getChild(statement, "statements", 1), body, flow);
+                NullState next = joinNulls(state, body);
+                if (next == head)
+                {
+                    break;
+                }
+                head = next;
+            }
+            noteDereferences(test, head, flow);
+            state = refineNulls(head, test, false, flow);
+        }
+        else if (kind == "DELETE")
+        {
+            TreeNode *pointer = getChild(statement, "expr", 1);
+            noteDereferences(pointer, state, flow);
+            Nullness known = nullnessOf(pointer, state, flow);
+            if (!flow.deletes.count(statement) || flow.deletes[statement] == known)
+            {
+                flow.deletes[statement] = known;
+            }
+            else
+            {
+                flow.deletes[statement] = MAYBENULL;
+            }
+        }
+        else
+        {
+            noteDereferences(statement, state, flow);
+        }
+    }
+}
+
+// Delete statements of a known NULL pointer are removed, and those of a
+// pointer known not to be NULL skip the check.
+void eliminateNullChecks(TreeNode *start, ProcedureTable &table)
+{
+    TreeNode *procedures = getChild(start, "procedures", 1);
+    while (true)
+    {
+        TreeNode *method = procedures->rule.rhs[0] == "main" ? getChild(procedures, "main", 1) : getChild(procedures, "procedure", 1);
+        string name = method->rule.lhs == "main" ? "wain" : getChild(method, "ID", 1)->token.lexeme;
+        NullFlow flow;
+        flow.current = &table.procedureMap[name];
+        collectAddressTaken(method, flow.addressTaken);
+        NullState state;
+        for (auto dcls : dclsList(getChild(method, "dcls", 1)))
+        {
+            if (dcls->children[3]->token.kind == "NULL" && !flow.addressTaken.count(dclName(getChild(dcls, "dcl", 1))))
+            {
+                state[dclName(getChild(dcls, "dcl", 1))] = ISNULL;
+            }
+        }
+        flowNulls(getChild(method, "statements", 1), state, flow);
+        noteDereferences(getChild(method, "expr", 1), state, flow);
+
+        set<TreeNode *> doomed;
+        for (auto &entry : flow.deletes)
+        {
+            if (entry.second == ISNULL)
+            {
+                doomed.insert(entry.first);
+            }
+            else if (entry.second == NOTNULL)
+            {
+                flow.current->checkedDeletes.insert(entry.first);
+            }
+        }
+        removeStatements(getChild(method, "statements", 1), doomed);
+        if (method->rule.lhs == "main")
+        {
+            break;
+        }
+        procedures = getChild(procedures, "procedures", 1);
+    }
+}
+
+//// DEAD CODE //////////////////////////////////////////////
+// Value of an expression built from NUM, NULL and arithmetic, wrapped to
+// 32 bits as the machine would, or false if it is not constant.
+bool constantValue(TreeNode *root, long long &value)
+{
+    root = innerNode(root);
+    if (root->rule.lhs == "factor" && root->rule.rhs[0] == "NULL")
+    {
+        value = 1;
+        return true;
+    }
+    if (root->rule.lhs == "factor")
+    {
+        return constantOperand(root, value);
+    }
+    long long left, right;
+    if (root->rule.rhs.size() != 3 || !constantValue(root->children[0], left) || !constantValue(root->children[2], right))
+    {
+        return false;
+    }
+    // pointer arithmetic scales the int operand
+    if (root->children[0]->type == "int*" && root->children[2]->type == "int")
+    {
+        right *= 4;
+    }
+    if (root->children[0]->type == "int" && root->children[2]->type == "int*")
+    {
+        left *= 4;
+    }
+    string op = root->children[1]->token.kind;
+    if ((op == "SLASH" || op == "PCT") && (right == 0 || (left == -2147483648LL && right == -1)))
+    {
+        return false;
+    }
+    if (op == "PLUS")
+    {
+        value = left + right;
+    }
+    else if (op == "MINUS")
+    {
+        value = left - right;
+        if (root->children[0]->type == "int*" && root->children[2]->type == "int*")
+        {
+            value /= 4;
+        }
+    }
+    else if (op == "STAR")
+    {
+        value = left * right;
+    }
+    else if (op == "SLASH")
+    {
+        value = left / right;
+    }
+    else
+    {
+        value = left % right;
+    }
+    value = (int)(unsigned int)value;
+    return true;
+}
+
+// Outcome of a test on constants, or false if it depends on the program.
+bool constantTest(TreeNode *test, bool &outcome)
+{
+    long long left, right;
+    if (!constantValue(test->children[0], left) || !constantValue(test->children[2], right))
+    {
+        return false;
+    }
+    // pointers compare unsigned
+    if (test->children[0]->type == "int*")
+    {
+        left = (unsigned int)left;
+        right = (unsigned int)right;
+    }
+    string op = test->children[1]->token.kind;
+    outcome = op == "EQ"   ? left == right
+              : op == "NE" ? left != right
+              : op == "LT" ? left < right
+              : op == "LE" ? left <= right
+              : op == "GE" ? left >= right
+                           : left > right;
+    return true;
+}
+
+// Replace ifs on constant tests by the branch they take and drop loops
+// that are never entered.
+void foldBranches(TreeNode *statements)
+{
+    vector<TreeNode *> list;
+    bool changed = false;
+    for (auto statement : statementList(statements))
+    {
+        bool outcome;
+        if (statement->rule.rhs[0] == "IF")
+        {
+            foldBranches(getChild(statement, "statements", 1));
+            foldBranches(getChild(statement, "statements", 2));
+        }
+        else if (statement->rule.rhs[0] == "WHILE")
+        {
+            foldBranches(getChild(statement, "statements", 1));
+        }
+        if (statement->rule.rhs[0] == "IF" && constantTest(getChild(statement, "test", 1), outcome))
+        {
+            TreeNode *taken = getChild(statement, "statements", outcome ? 1 : 2);
+            vector<TreeNode *> branch = statementList(taken);
+            list.insert(list.end(), branch.begin(), branch.end());
+            setStatements(taken, {});
+            delete statement;
+            changed = true;
+        }
+        else if (statement->rule.rhs[0] == "WHILE" && constantTest(getChild(statement, "test", 1), outcome) && !outcome)
+        {
+            delete statement;
+            changed = true;
+        }
+        else
+        {
+            list.push_back(statement);
+        }
+    }
+    if (changed)
+    {
+        setStatements(statements, list);
+    }
+}
+
+// Variables read anywhere in the subtree.
+void collectReads(TreeNode *root, set<string> &reads)
+{
+    if (root->rule.lhs == "factor" && root->rule.rhs.size() == 1 && root->rule.rhs[0] == "ID")
+    {
+        reads.insert(root->children[0]->token.lexeme);
+    }
+    for (auto child : root->children)
+    {
+        collectReads(child, reads);
+    }
+}
+
+// Variables live before a statement list given those live after it. With
+// remove set, assignments to variables dead at that point whose value has
+// no side effects are deleted on the way. Variables whose address is taken
+// are always treated as live.
+set<string> liveBefore(TreeNode *statements, set<string> live, set<string> &addressTaken, Procedure &current, bool remove)
+{
+    vector<TreeNode *> list = statementList(statements);
+    vector<TreeNode *> kept;
+    for (auto it = list.rbegin(); it != list.rend(); it++)
+    {
+        TreeNode *statement = *it;
+        string kind = statement->rule.rhs[0];
+        if (kind == "lvalue")
+        {
+            TreeNode *value = getChild(statement, "expr", 1);
+            string name = variableName(getChild(statement, "lvalue", 1));
+            if (name != "" && !addressTaken.count(name) && !live.count(name) && !hasSideEffects(value))
+            {
+                if (remove)
+                {
+                    delete statement;
+                    continue;
+                }
+            }
+            else
+            {
+                if (name != "")
+                {
+                    live.erase(name);
+                }
+                collectReads(statement, live);
+            }
+        }
+        else if (kind == "IF")
+        {
+            set<string> taken = liveBefore(getChild(statement, "statements", 1), live, addressTaken, current, remove);
+            live = liveBefore(getChild(statement, "statements", 2), live, addressTaken, current, remove);
+            live.insert(taken.begin(), taken.end());
+            collectReads(getChild(statement, "test", 1), live);
+        }
+        else if (kind == "WHILE")
+        {
+            // the tests run before the body and after every pass through it
+            set<string> head = live;
+            collectReads(getChild(statement, "test", 1), head);
+            if (current.bottomTests.count(statement))
+            {
+                collectReads(current.bottomTests[statement], head);
+            }
+            while (true)
+            {
+                set<string> next = liveBefore(getChild(statement, "statements", 1), head, addressTaken, current, false);
+                next.insert(head.begin(), head.end());
+                if (next == head)
+                {
+                    break;
+                }
+                head = next;
+            }
+            if (remove)
+            {
+                liveBefore(getChild(statement, "statements", 1), head, addressTaken, current, true);
+            }
+            live = head;
+        }
+        else
+        {
+            collectReads(statement, live);
+        }
+        kept.push_back(statement);
+    }
+    if (remove && kept.size() != list.size())
+    {
+        reverse(kept.begin(), kept.end());
+        setStatements(statements, kept);
+    }
+    return live;
+}
+
+// Replace int arithmetic on constants by its value. Negative results are
+// left alone since NUM is never negative.
+void foldExpressions(TreeNode *root)
+{
+    long long value;
+    if ((root->rule.lhs == "expr" || root->rule.lhs == "term") && root->rule.rhs.size() == 3 && root->type == "int" && constantValue(root, value) && value >= 0)
+    {
+        TreeNode *factor = makeRule("factor", {makeToken("NUM", to_string(value))}, "int");
+        replaceNode(root, root->rule.lhs == "expr" ? makeFactorExpr(factor) : makeRule("term", {factor}, "int"));
+        return;
+    }
+    for (auto child : root->children)
+    {
+        foldExpressions(child);
+    }
+}
+
+void foldConstants(TreeNode *start, ProcedureTable &)
+{
+    TreeNode *procedures = getChild(start, "procedures", 1);
+    while (true)
+    {
+        TreeNode *method = procedures->rule.rhs[0] == "main" ? getChild(procedures, "main", 1) : getChild(procedures, "procedure", 1);
+        foldExpressions(method);
+        foldBranches(getChild(method, "statements", 1));
+        if (method->rule.lhs == "main")
+        {
+            break;
+        }
+        procedures = getChild(procedures, "procedures", 1);
+    }
+}
+
+// Remove dead stores, and skip the initializers of locals that are always
+// assigned before they are read.
+void eliminateDeadStores(TreeNode *start, ProcedureTable &table)
+{
+    TreeNode *procedures = getChild(start, "procedures", 1);
+    while (true)
+    {
+        TreeNode *method = procedures->rule.rhs[0] == "main" ? getChild(procedures, "main", 1) : getChild(procedures, "procedure", 1);
+        string name = method->rule.lhs == "main" ? "wain" : getChild(method, "ID", 1)->token.lexeme;
+        Procedure &current = table.procedureMap[name];
+        set<string> addressTaken;
+        collectAddressTaken(method, addressTaken);
+        set<string> live;
+        collectReads(getChild(method, "expr", 1), live);
+        live = liveBefore(getChild(method, "statements", 1), live, addressTaken, current, true);
+        current.deadInitializers.clear();
+        for (auto dcls : dclsList(getChild(method, "dcls", 1)))
+        {
+            string local = dclName(getChild(dcls, "dcl", 1));
+            if (!live.count(local) && !addressTaken.count(local))
+            {
+                current.deadInitializers.insert(local);
+            }
+        }
+        if (method->rule.lhs == "main")
+        {
+            break;
+        }
+        procedures = getChild(procedures, "procedures", 1);
+    }
+}
+
+//// CONSTANT ARGUMENTS /////////////////////////////////////
+// A parameter every call passes the same constant becomes a local
+// initialized to it, and its reads become the constant. Procedures whose
+// tests read parameters that different calls pass different constants
+// for are first cloned per combination.
+const int maxClonedSize = 400; // tree nodes
+const int maxClones = 3;       // per procedure
+
+// Text of a constant argument ("NULL" or a non-negative NUM), or "".
+string constantArgument(TreeNode *arg)
+{
+    long long value;
+    if (!constantValue(arg, value))
+    {
+        return "";
+    }
+    if (arg->type == "int*")
+    {
+        return value == 1 ? "NULL" : "";
+    }
+    return value >= 0 ? to_string(value) : "";
+}
+
+void collectCalls(TreeNode *root, map<string, vector<TreeNode *>> &calls)
+{
+    if (isCall(root))
+    {
+        calls[getChild(root, "ID", 1)->token.lexeme].push_back(root);
+    }
+    for (auto child : root->children)
+    {
+        collectCalls(child, calls);
+    }
+}
+
+// Free an arglist or paramlist chain, but not the nodes it lists.
+void unlinkList(TreeNode *list)
+{
+    while (list != nullptr)
+    {
+        TreeNode *next = list->children.size() == 3 ? list->children[2] : nullptr;
+        if (next != nullptr)
+        {
+            delete list->children[1];
+        }
+        list->children.clear();
+        delete list;
+        list = next;
+    }
+}
+
+// Build the "first , rest" chain of an arglist or paramlist.
+TreeNode *makeList(string lhs, vector<TreeNode *> items)
+{
+    TreeNode *list = nullptr;
+    for (auto it = items.rbegin(); it != items.rend(); it++)
+    {
+        list = list == nullptr ? makeRule(lhs, {*it}, "") : makeRule(lhs, {*it, makeToken("COMMA", ","), list}, "");
+    }
+    return list;
+}
+
+// Replace the arguments of a call; arguments left out are freed.
+void setArguments(TreeNode *call, vector<TreeNode *> args)
+{
+    for (auto arg : argList(call))
+    {
+        if (find(args.begin(), args.end(), arg) == args.end())
+        {
+            delete arg;
+        }
+    }
+    if (call->rule.rhs.size() == 4)
+    {
+        unlinkList(getChild(call, "arglist", 1));
+    }
+    TreeNode *id = call->children[0];
+    TreeNode *lparen = call->children[1];
+    TreeNode *rparen = call->children.back();
+    call->rule.rhs = {"ID", "LPAREN", "RPAREN"};
+    call->children = {id, lparen, rparen};
+    if (!args.empty())
+    {
+        call->rule.rhs = {"ID", "LPAREN", "arglist", "RPAREN"};
+        call->children = {id, lparen, makeList("arglist", args), rparen};
+    }
+}
+
+void dropArguments(TreeNode *call, vector<bool> &dropped)
+{
+    vector<TreeNode *> args;
+    vector<TreeNode *> old = argList(call);
+    for (size_t i = 0; i < old.size(); i++)
+    {
+        if (!dropped[i])
+        {
+            args.push_back(old[i]);
+        }
+    }
+    setArguments(call, args);
+}
+
+// Replace the parameter declarations of a procedure; the caller keeps
+// ownership of the ones left out.
+void setParams(TreeNode *method, vector<TreeNode *> dcls)
+{
+    TreeNode *params = getChild(method, "params", 1);
+    if (!params->rule.rhs.empty())
+    {
+        unlinkList(getChild(params, "paramlist", 1));
+    }
+    params->rule.rhs.clear();
+    params->children.clear();
+    if (!dcls.empty())
+    {
+        params->rule.rhs = {"paramlist"};
+        params->children = {makeList("paramlist", dcls)};
+    }
+}
+
+// Variables read by an if or while test in the subtree.
+void collectTestReads(TreeNode *root, set<string> &reads)
+{
+    if (root->rule.lhs == "test")
+    {
+        collectReads(root, reads);
+    }
+    for (auto child : root->children)
+    {
+        collectTestReads(child, reads);
+    }
+}
+
+// Make a parameter of a procedure a local initialized to a constant; its
+// reads become the constant when nothing assigns it. The caller removes it
+// from the parameter list.
+void bindParameter(TreeNode *method, TreeNode *dcl, string value)
+{
+    string name = dclName(dcl);
+    set<string> addressTaken;
+    collectAddressTaken(method, addressTaken);
+    TreeNode *constant = value == "NULL" ? makeRule("factor", {makeToken("NULL", "NULL")}, "int*") : makeRule("factor", {makeToken("NUM", value)}, "int");
+    if (countAssignments(method, name) == 0 && !addressTaken.count(name))
+    {
+        map<string, TreeNode *> values = {{name, constant}};
+        substituteVariables(getChild(method, "statements", 1), values);
+        substituteVariables(getChild(method, "expr", 1), values);
+    }
+    appendDcls(method, dcl, makeToken(constant->children[0]->token.kind, value));
+    delete constant;
+}
+
+// Drop the parameters flagged in dropped from a procedure and its calls.
+void dropParameters(TreeNode *method, Procedure &procedure, vector<TreeNode *> &calls, vector<bool> &dropped)
+{
+    vector<TreeNode *> kept;
+    procedure.signature.clear();
+    vector<TreeNode *> params = paramList(method);
+    for (size_t i = 0; i < params.size(); i++)
+    {
+        if (!dropped[i])
+        {
+            kept.push_back(params[i]);
+            procedure.signature.push_back(dclType(params[i]));
+        }
+    }
+    setParams(method, kept);
+    for (auto call : calls)
+    {
+        dropArguments(call, dropped);
+    }
+}
+
+struct Specializer
+{
+    map<string, TreeNode *> methods;                 // procedure name -> its procedures chain node
+    map<string, map<vector<string>, string>> clones; // procedure -> constants -> clone
+    map<string, string> original;                    // clone -> procedure it was made from
+};
+
+// The constants a call passes for the parameters that steer tests in the
+// callee, with "" for the others. A parameter only steers if recursive
+// calls pass it on unchanged, so clones are never made per recursion depth.
+vector<string> cloneKey(TreeNode *call, TreeNode *method)
+{
+    set<string> steering;
+    collectTestReads(method, steering);
+    vector<TreeNode *> params = paramList(method);
+    map<string, vector<TreeNode *>> calls;
+    collectCalls(method, calls);
+    for (auto self : calls[getChild(method, "ID", 1)->token.lexeme])
+    {
+        for (size_t i = 0; i < params.size(); i++)
+        {
+            if (variableName(argList(self)[i]) != dclName(params[i]))
+            {
+                steering.erase(dclName(params[i]));
+            }
+        }
+    }
+    vector<TreeNode *> args = argList(call);
+    vector<string> key;
+    for (size_t i = 0; i < params.size(); i++)
+    {
+        key.push_back(steering.count(dclName(params[i])) ? constantArgument(args[i]) : "");
+    }
+    return key;
+}
+
+// Clone procedures for the constant combinations their calls pass, with
+// those parameters bound to the constants, and send every matching call,
+// including those inside clones, to its clone.
+bool cloneProcedures(TreeNode *start, ProcedureTable &table, Specializer &specializer)
+{
+    bool changed = false;
+    map<string, vector<TreeNode *>> calls;
+    collectCalls(start, calls);
+    for (auto &entry : calls)
+    {
+        // calls already sent to a clone stay there
+        string name = entry.first;
+        if (!specializer.methods.count(name) || specializer.original.count(name))
+        {
+            continue;
+        }
+        TreeNode *method = getChild(specializer.methods[name], "procedure", 1);
+        for (auto call : entry.second)
+        {
+            vector<string> key = cloneKey(call, method);
+            if (count(key.begin(), key.end(), "") == (int)key.size())
+            {
+                continue;
+            }
+            map<vector<string>, string> &clones = specializer.clones[name];
+            if (!clones.count(key))
+            {
+                if ((int)clones.size() >= maxClones || treeSize(method) > maxClonedSize)
+                {
+                    continue;
+                }
+                string clone;
+                int k = 1;
+                do
+                {
+                    clone = name + "C" + to_string(k++);
+                } while (table.procedureMap.count(clone));
+                TreeNode *copy = cloneTree(method);
+                getChild(copy, "ID", 1)->token.lexeme = clone;
+                TreeNode *chain = specializer.methods[name];
+                TreeNode *link = makeRule("procedures", {copy, chain->children.back()}, "");
+                chain->children.back() = link;
+                Procedure procedure = table.procedureMap[name];
+                procedure.name = clone;
+                vector<TreeNode *> params = paramList(copy);
+                vector<bool> dropped;
+                for (size_t i = 0; i < params.size(); i++)
+                {
+                    dropped.push_back(key[i] != "");
+                    if (key[i] != "")
+                    {
+                        bindParameter(copy, params[i], key[i]);
+                    }
+                }
+                vector<TreeNode *> none;
+                dropParameters(copy, procedure, none, dropped);
+                table.procedureMap[clone] = procedure;
+                specializer.methods[clone] = link;
+                specializer.original[clone] = name;
+                clones[key] = clone;
+            }
+            vector<bool> dropped;
+            for (auto value : key)
+            {
+                dropped.push_back(value != "");
+            }
+            getChild(call, "ID", 1)->token.lexeme = clones[key];
+            dropArguments(call, dropped);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Turn parameters every call passes the same constant into initialized
+// locals and drop them from the calls. Clones keep the parameters they
+// were made with, so that later calls can still be sent to them.
+bool propagateArguments(TreeNode *start, ProcedureTable &table, Specializer &specializer)
+{
+    bool changed = false;
+    map<string, vector<TreeNode *>> calls;
+    collectCalls(start, calls);
+    for (auto &entry : specializer.methods)
+    {
+        TreeNode *method = getChild(entry.second, "procedure", 1);
+        vector<TreeNode *> &sites = calls[entry.first];
+        if (sites.empty() || specializer.original.count(entry.first))
+        {
+            continue;
+        }
+        vector<TreeNode *> params = paramList(method);
+        vector<bool> dropped;
+        for (size_t i = 0; i < params.size(); i++)
+        {
+            string value = constantArgument(argList(sites[0])[i]);
+            for (auto call : sites)
+            {
+                value = constantArgument(argList(call)[i]) == value ? value : "";
+            }
+            dropped.push_back(value != "");
+            if (value != "")
+            {
+                bindParameter(method, params[i], value);
+                changed = true;
+            }
+        }
+        dropParameters(method, table.procedureMap[entry.first], sites, dropped);
+    }
+    return changed;
+}
+
+void specializeProcedures(TreeNode *start, ProcedureTable &table)
+{
+    Specializer specializer;
+    TreeNode *procedures = getChild(start, "procedures", 1);
+    while (procedures->rule.rhs[0] == "procedure")
+    {
+        specializer.methods[getChild(getChild(procedures, "procedure", 1), "ID", 1)->token.lexeme] = procedures;
+        procedures = getChild(procedures, "procedures", 1);
+    }
+    // constants propagated into a clone can let its own calls specialize
+    for (int round = 0; round < 3; round++)
+    {
+        bool cloned = cloneProcedures(start, table, specializer);
+        bool propagated = propagateArguments(start, table, specializer);
+        if (!cloned && !propagated)
+        {
+            break;
+        }
+    }
+}
+//// PURE CALLS /////////////////////////////////////////////
+// Calls with constant arguments to procedures that only compute on their
+// own variables are run at compile time by a small interpreter and
+// replaced by the value they return. The interpreter gives up on anything
+// the machine would do differently or that runs too long.
+const long long callBudget = 100000;    // interpreter steps per call
+const long long programBudget = 2000000; // interpreter steps per program
+const int maxCallDepth = 200;
+
+struct Interpreter
+{
+    map<string, TreeNode *> methods; // pure procedure name -> procedure node
+    long long steps;                 // left for the current call
+    int depth;
+};
+
+// Whether the subtree does nothing but arithmetic on variables and calls.
+bool computesOnly(TreeNode *root)
+{
+    if (root->tokenvrule == "token")
+    {
+        string kind = root->token.kind;
+        return kind != "PRINTLN" && kind != "NEW" && kind != "DELETE" && kind != "AMP";
+    }
+    if ((root->rule.lhs == "factor" || root->rule.lhs == "lvalue") && !root->rule.rhs.empty() && root->rule.rhs[0] == "STAR")
+    {
+        return false;
+    }
+    for (auto child : root->children)
+    {
+        if (!computesOnly(child))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool runCall(TreeNode *call, map<string, long long> &env, Interpreter &interpreter, long long &value);
+
+bool evaluate(TreeNode *root, map<string, long long> &env, Interpreter &interpreter, long long &value)
+{
+    if (--interpreter.steps < 0)
+    {
+        return false;
+    }
+    if (root->rule.lhs == "factor")
+    {
+        string first = root->rule.rhs[0];
+        if (first == "NUM")
+        {
+            value = stoll(root->children[0]->token.lexeme);
+            return value <= 2147483647;
+        }
+        if (first == "NULL")
+        {
+            value = 1;
+            return true;
+        }
+        if (first == "LPAREN")
+        {
+            return evaluate(getChild(root, "expr", 1), env, interpreter, value);
+        }
+        if (isCall(root))
+        {
+            return runCall(root, env, interpreter, value);
+        }
+        value = env[root->children[0]->token.lexeme];
+        return true;
+    }
+    if (root->rule.rhs.size() == 1)
+    {
+        return evaluate(root->children[0], env, interpreter, value);
+    }
+    long long left, right;
+    if (!evaluate(root->children[0], env, interpreter, left) || !evaluate(root->children[2], env, interpreter, right))
+    {
+        return false;
+    }
+    bool pointers = root->children[0]->type == "int*" && root->children[2]->type == "int*";
+    if (root->children[0]->type == "int*" && root->children[2]->type == "int")
+    {
+        right *= 4;
+    }
+    if (root->children[0]->type == "int" && root->children[2]->type == "int*")
+    {
+        left *= 4;
+    }
+    string op = root->children[1]->token.kind;
+    if (root->rule.lhs == "test")
+    {
+        if (pointers)
+        {
+            left = (unsigned int)left;
+            right = (unsigned int)right;
+        }
+        value = op == "EQ"   ? left == right
+                : op == "NE" ? left != right
+                : op == "LT" ? left < right
+                : op == "LE" ? left <= right
+                : op == "GE" ? left >= right
+                             : left > right;
+        return true;
+    }
+    // the machine leaves these undefined
+    if ((op == "SLASH" || op == "PCT") && (right == 0 || (left == -2147483648LL && right == -1)))
+    {
+        return false;
+    }
+    value = op == "PLUS"    ? left + right
+            : op == "MINUS" ? left - right
+            : op == "STAR"  ? left * right
+            : op == "SLASH" ? left / right
+                            : left % right;
+    if (op == "MINUS" && pointers)
+    {
+        // differences of aligned addresses are exact
+        value = (int)(unsigned int)value / 4;
+    }
+    value = (int)(unsigned int)value;
+    return true;
+}
+
+bool execute(TreeNode *statements, map<string, long long> &env, Interpreter &interpreter)
+{
+    for (auto statement : statementList(statements))
+    {
+        long long value;
+        string kind = statement->rule.rhs[0];
+        if (kind == "lvalue")
+        {
+            if (!evaluate(getChild(statement, "expr", 1), env, interpreter, value))
+            {
+                return false;
+            }
+            env[variableName(getChild(statement, "lvalue", 1))] = value;
+        }
+        else if (kind == "IF")
+        {
+            if (!evaluate(getChild(statement, "test", 1), env, interpreter, value) || !execute(getChild(statement, "statements", value ? 1 : 2), env, interpreter))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            while (true)
+            {
+                if (!evaluate(getChild(statement, "test", 1), env, interpreter, value))
+                {
+                    return false;
+                }
+                if (!value)
+                {
+                    break;
+                }
+                if (!execute(getChild(statement, "statements", 1), env, interpreter))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool runCall(TreeNode *call, map<string, long long> &env, Interpreter &interpreter, long long &value)
+{
+    string name = getChild(call, "ID", 1)->token.lexeme;
+    if (!interpreter.methods.count(name) || interpreter.depth >= maxCallDepth)
+    {
+        return false;
+    }
+    TreeNode *method = interpreter.methods[name];
+    map<string, long long> locals;
+    vector<TreeNode *> params = paramList(method);
+    vector<TreeNode *> args = argList(call);
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        if (!evaluate(args[i], env, interpreter, value))
+        {
+            return false;
+        }
+        locals[dclName(params[i])] = value;
+    }
+    for (auto dcls : dclsList(getChild(method, "dcls", 1)))
+    {
+        locals[dclName(getChild(dcls, "dcl", 1))] = dcls->children[3]->token.kind == "NULL" ? 1 : stoll(dcls->children[3]->token.lexeme);
+    }
+    interpreter.depth++;
+    bool done = execute(getChild(method, "statements", 1), locals, interpreter) && evaluate(getChild(method, "expr", 1), locals, interpreter, value);
+    interpreter.depth--;
+    return done;
+}
+
+// Replace pure calls with constant arguments, innermost first.
+void foldCalls(TreeNode *root, Interpreter &interpreter, long long &budget)
+{
+    for (auto child : root->children)
+    {
+        foldCalls(child, interpreter, budget);
+    }
+    if (!isCall(root) || !interpreter.methods.count(getChild(root, "ID", 1)->token.lexeme) || budget <= 0)
+    {
+        return;
+    }
+    long long value;
+    for (auto arg : argList(root))
+    {
+        if (!constantValue(arg, value))
+        {
+            return;
+        }
+    }
+    map<string, long long> env;
+    interpreter.steps = min(callBudget, budget);
+    interpreter.depth = 0;
+    bool done = runCall(root, env, interpreter, value);
+    budget -= min(callBudget, budget) - max(interpreter.steps, 0LL);
+    if (!done || value == -2147483648LL)
+    {
+        return;
+    }
+    TreeNode *number = makeRule("factor", {makeToken("NUM", to_string(value < 0 ? -value : value))}, "int");
+    if (value >= 0)
+    {
+        replaceNode(root, number);
+        return;
+    }
+    // NUM is never negative, so a negative result becomes (0 - n)
+    TreeNode *zero = makeFactorExpr(makeRule("factor", {makeToken("NUM", "0")}, "int"));
+    TreeNode *difference = makeRule("expr", {zero, makeToken("MINUS", "-"), makeRule("term", {number}, "int")}, "int");
+    replaceNode(root, makeRule("factor", {makeToken("LPAREN", "("), difference, makeToken("RPAREN", ")")}, "int"));
+}
+
+void evaluatePureCalls(TreeNode *start, ProcedureTable &)
+{
+    Interpreter interpreter;
+    map<string, TreeNode *> methods;
+    TreeNode *procedures = getChild(start, "procedures", 1);
+    while (procedures->rule.rhs[0] == "procedure")
+    {
+        TreeNode *method = getChild(procedures, "procedure", 1);
+        methods[getChild(method, "ID", 1)->token.lexeme] = method;
+        procedures = getChild(procedures, "procedures", 1);
+    }
+    // a procedure is pure if its body is and everything it calls is
+    for (auto &entry : methods)
+    {
+        if (computesOnly(getChild(entry.second, "dcls", 1)) && computesOnly(getChild(entry.second, "statements", 1)) && computesOnly(getChild(entry.second, "expr", 1)))
+        {
+            interpreter.methods.insert(entry);
+        }
+    }
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto &entry : methods)
+        {
+            set<string> callees;
+            collectCallees(entry.second, callees);
+            for (auto callee : callees)
+            {
+                if (interpreter.methods.count(entry.first) && !interpreter.methods.count(callee))
+                {
+                    interpreter.methods.erase(entry.first);
+                    changed = true;
+                }
+            }
+        }
+    }
+    long long budget = programBudget;
+    foldCalls(getChild(start, "procedures", 1), interpreter, budget);
+}
+
 //// CODE GENERATION //////////////////////////////////////////
-void codeLvalue(TreeNode *root, map<string, int> offset_table);
+struct Frame
+{
+    map<string, int> offset_table; // variable -> offset from the base register
+    int base;                      // $29, or $30 in procedures without a frame pointer
+    Procedure method;
+    ProcedureTable *procedures;
+    vector<string> params; // in declaration order
+    // the frame is allocated once on entry: saved registers and locals at
+    // the top, temporaries below them and outgoing arguments at the bottom
+    int size;     // words below the entry $30
+    int outgoing; // words for the arguments of the largest call
+    int temps;    // temporaries in use
+    int maxTemps;
+    int zeroStart; // run of memory locals initialized to 0
+    int zeroCount;
+    map<TreeNode *, int> arrays; // frame arrays -> slot of their first word
+};
+
+// Offset of a variable from frame.base; offsets are recorded relative to
+// $29 = entry $30 - 4 and shifted by the frame size when addressing off $30.
+int varOffset(Frame &frame, string name)
+{
+    if (frame.base == 30)
+    {
+        return frame.offset_table[name] - 4 + 4 * frame.size;
+    }
+    return frame.offset_table[name];
+}
+
+// Offset from frame.base of the word slot words below $29.
+int slotOffset(Frame &frame, int slot)
+{
+    if (frame.base == 30)
+    {
+        return -4 * slot - 4 + 4 * frame.size;
+    }
+    return -4 * slot;
+}
+
+// Temporaries sit just above the outgoing arguments and are addressed off
+// $30, which stays fixed for the whole body.
+void spill(int reg, Frame &frame)
+{
+    sw(reg, 4 * (frame.outgoing + frame.temps), 30);
+    frame.temps++;
+    frame.maxTemps = max(frame.maxTemps, frame.temps);
+}
+
+void reload(int reg, Frame &frame)
+{
+    frame.temps--;
+    lw(reg, 4 * (frame.outgoing + frame.temps), 30);
+}
+
+// Largest argument count of any call in the subtree.
+int maxArgs(TreeNode *root)
+{
+    int count = 0;
+    if (isCall(root))
+    {
+        count = argList(root).size();
+    }
+    for (auto child : root->children)
+    {
+        count = max(count, maxArgs(child));
+    }
+    return count;
+}
+
+// Literal that has to be loaded with lis when the factor is coded, or "".
+string loadedLiteral(TreeNode *factor)
+{
+    if (factor->rule.rhs[0] != "NUM")
+    {
+        return "";
+    }
+    string value = getChild(factor, "NUM", 1)->token.lexeme;
+    return value == "0" || value == "1" || value == "4" ? "" : value;
+}
+
+// Weigh the literals the subtree loads, with uses inside loops counting
+// four times per level of nesting, or by how often their block ran
+// with a profile.
+void countConstants(TreeNode *root, Procedure &current, ProcedureTable &table, map<string, long long> &uses, long long weight)
+{
+    weight = regionWeight(root, table, weight);
+    if (root->rule.lhs == "dcls" && root->rule.rhs.size() > 1)
+    {
+        string name = dclName(getChild(root, "dcl", 1));
+        string value = root->children[3]->token.lexeme;
+        if (root->children[3]->token.kind == "NUM" && value != "0" && value != "1" && value != "4" && !current.deadInitializers.count(name))
+        {
+            uses[value] += weight;
+        }
+    }
+    if (root->rule.lhs == "statement" && root->rule.rhs[0] == "WHILE" && !table.profiled)
+    {
+        weight = min(weight * 4, 64LL);
+    }
+    if (root->rule.lhs == "factor" && loadedLiteral(root) != "")
+    {
+        uses[loadedLiteral(root)] += weight;
+    }
+    // constant pointer offsets are loaded already scaled
+    long long value;
+    if (root->rule.lhs == "expr" && root->rule.rhs.size() == 3 && getChild(root, "expr", 1)->type == "int*" && getChild(root, "term", 1)->type == "int" && simpleFactor(getChild(root, "term", 1)) != nullptr && constantOperand(simpleFactor(getChild(root, "term", 1)), value))
+    {
+        string offset = to_string((int)(unsigned int)(value * 4));
+        if (offset != "0" && offset != "4")
+        {
+            uses[offset] += weight;
+        }
+        if (loadedLiteral(simpleFactor(getChild(root, "term", 1))) != "")
+        {
+            uses[loadedLiteral(simpleFactor(getChild(root, "term", 1)))] -= weight;
+        }
+    }
+    for (auto child : root->children)
+    {
+        countConstants(child, current, table, uses, childWeight(root, child, table, weight));
+    }
+}
+
+// Keep variables whose address is never taken in registers, most used first,
+// or most run first with a profile. Leaf procedures start with registers no
+// caller keeps live across a call; after that $15-$28 are used, saved in the
+// prologue except in wain. The registers left over hold the literals the
+// procedure loads most.
+void allocateRegisters(TreeNode *method, Procedure &current, ProcedureTable &table)
+{
+    bool isMain = method->rule.lhs == "main";
+    current.registers.clear();
+    current.savedRegisters.clear();
+    current.constants.clear();
+    set<string> addressTaken;
+    collectAddressTaken(method, addressTaken);
+    map<string, long long> weights;
+    weighUses(method, current, table, weights, 1);
+    vector<pair<pair<long long, int>, string>> candidates;
+    for (auto &entry : current.localTable.varMap)
+    {
+        int uses = countUses(method, entry.first);
+        for (auto &loop : current.bottomTests)
+        {
+            uses += countUses(loop.second, entry.first);
+        }
+        if (entry.second.name != "" && !addressTaken.count(entry.first) && uses > 0)
+        {
+            candidates.push_back({{-weights[entry.first], -uses}, entry.first});
+        }
+    }
+    sort(candidates.begin(), candidates.end());
+
+    vector<int> scratch;
+    if (current.leaf)
+    {
+        scratch = {8, 7, 6, 2, 1};
+    }
+    int next = 15;
+    for (auto candidate : candidates)
+    {
+        if (!scratch.empty())
+        {
+            current.registers[candidate.second] = scratch.back();
+            scratch.pop_back();
+        }
+        // a single use does not pay for saving and restoring the register
+        else if (next <= 28 && (isMain || -candidate.first.second > 1))
+        {
+            current.registers[candidate.second] = next;
+            if (!isMain)
+            {
+                current.savedRegisters.push_back(next);
+            }
+            next++;
+        }
+    }
+
+    // loading a literal at entry costs two words, and saving the register
+    // two more, so it has to be used at least that often per call
+    map<string, long long> uses;
+    countConstants(method, current, table, uses, 1);
+    vector<pair<long long, string>> literals;
+    for (auto &entry : uses)
+    {
+        literals.push_back({-entry.second / max(regionWeight(method, table, 1), 1LL), entry.first});
+    }
+    sort(literals.begin(), literals.end());
+    for (auto literal : literals)
+    {
+        if (!scratch.empty() && -literal.first >= 2)
+        {
+            current.constants[literal.second] = scratch.back();
+            scratch.pop_back();
+        }
+        else if (next <= 28 && -literal.first >= (isMain ? 2 : 4))
+        {
+            current.constants[literal.second] = next;
+            if (!isMain)
+            {
+                current.savedRegisters.push_back(next);
+            }
+            next++;
+        }
+    }
+}
+
+// Register holding a variable, or 0 if it lives in the frame.
+int varRegister(Frame &frame, string name)
+{
+    if (frame.method.registers.count(name))
+    {
+        return frame.method.registers[name];
+    }
+    return 0;
+}
+
+// Register holding the variable an lvalue names, or 0 if it is in memory.
+int lvalueRegister(TreeNode *lvalue, Frame &frame)
+{
+    lvalue = innerNode(lvalue);
+    if (lvalue->rule.rhs[0] != "ID")
+    {
+        return 0;
+    }
+    return varRegister(frame, getChild(lvalue, "ID", 1)->token.lexeme);
+}
+
+// Instruction costs in cycles for choosing between mult/div and the
+// sequences that replace them; everything else takes one cycle.
+const int multCost = 12;
+const int divCost = 35;
+
+// Cycles for multiplying by a positive constant with doublings and adds.
+int chainCost(unsigned long long value)
+{
+    int bits = 0;
+    int ones = 0;
+    for (unsigned long long v = value; v != 0; v /= 2)
+    {
+        bits++;
+        ones += v % 2;
+    }
+    // copy of x, one doubling per bit after the first and one add per other set bit
+    return (ones > 1 ? 1 : 0) + (bits - 1) + (ones - 1);
+}
+
+// $3 = $3 * value for a constant value >= 0, using $5. Constants whose add
+// chain is cheaper than a mult become doublings and adds.
+void multiplyConstant(long long value)
+{
+    if (value == 0)
+    {
+        add(3, 0, 0);
+        return;
+    }
+    if (chainCost(value) >= multCost + 2)
+    {
+        lis(5);
+        word(value);
+        mult(3, 5);
+        mflo(3);
+        return;
+    }
+    int bits = 0;
+    for (long long v = value; v != 0; v /= 2)
+    {
+        bits++;
+    }
+    if (value & (value - 1))
+    {
+        add(5, 3, 0);
+    }
+    for (int bit = bits - 2; bit >= 0; bit--)
+    {
+        add(3, 3, 3);
+        if ((value >> bit) & 1)
+        {
+            add(3, 3, 5);
+        }
+    }
+}
+
+// Magic multiplier and shift for signed division by d >= 2 (Hacker's
+// Delight 10-1): n / d = hi(n * multiplier) [+ n] >> shift, plus 1 if n < 0.
+void divisionMagic(long long d, int &multiplier, int &shift)
+{
+    const unsigned int two31 = 0x80000000;
+    unsigned int ad = d;
+    unsigned int anc = two31 - 1 - two31 % ad;
+    int p = 31;
+    unsigned int q1 = two31 / anc;
+    unsigned int r1 = two31 - q1 * anc;
+    unsigned int q2 = two31 / ad;
+    unsigned int r2 = two31 - q2 * ad;
+    unsigned int delta;
+    do
+    {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad)
+        {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    multiplier = q2 + 1;
+    shift = p - 32;
+}
+
+// $3 = $3 / value or $3 % value for a constant value >= 1, using $5 and
+// $14. There are no shift instructions, so an arithmetic shift right by s is
+// a mult by 2^(32-s) keeping the high word; that needs s >= 2, and the
+// division stays a div when neither form is cheaper.
+void divideConstant(long long value, bool remainder)
+{
+    if (value == 1)
+    {
+        if (remainder)
+        {
+            add(3, 0, 0);
+        }
+        return;
+    }
+
+    int power = 0;
+    while ((1LL << power) < value)
+    {
+        power++;
+    }
+    bool powerOfTwo = (1LL << power) == value && power >= 2;
+    int multiplier = 0;
+    int shift = power;
+    int cost;
+    if (powerOfTwo)
+    {
+        // round negative dividends toward zero, then shift
+        cost = 4 + 1 + multCost + 1;
+    }
+    else
+    {
+        divisionMagic(value, multiplier, shift);
+        cost = 1 + multCost + 1 + (multiplier < 0 ? 1 : 0) + (shift > 0 ? multCost + 2 : 0) + 2;
+    }
+    if (remainder)
+    {
+        cost += min(chainCost(value), multCost + 2) + 1;
+    }
+    if (shift == 1 || cost >= divCost + 2)
+    {
+        lis(5);
+        word(value);
+        divide(3, 5);
+        if (remainder)
+        {
+            mfhi(3);
+        }
+        else
+        {
+            mflo(3);
+        }
+        return;
+    }
+
+    if (remainder || !powerOfTwo)
+    {
+        add(14, 3, 0);
+    }
+    if (powerOfTwo)
+    {
+        slt(5, 3, 0);
+        beq(5, 0, to_string(3));
+        lis(5);
+        word(value - 1);
+        add(3, 3, 5);
+    }
+    else
+    {
+        lis(5);
+        word(multiplier);
+        mult(3, 5);
+        mfhi(3);
+        if (multiplier < 0)
+        {
+            add(3, 3, 14);
+        }
+    }
+    if (shift > 0)
+    {
+        lis(5);
+        word(1 << (32 - shift));
+        mult(3, 5);
+        mfhi(3);
+    }
+    if (!powerOfTwo)
+    {
+        // truncate toward zero: add 1 when the dividend is negative
+        slt(5, 14, 0);
+        add(3, 3, 5);
+    }
+    if (remainder)
+    {
+        // n % d = n - (n / d) * d, which has the sign of n
+        multiplyConstant(value);
+        sub(3, 14, 3);
+    }
+}
+
+void codeLvalue(TreeNode *root, Frame &frame);
+void codeExpr(TreeNode *root, Frame &frame);
+int constantRegister(string value, Frame &frame);
+int codeOperand(TreeNode *factor, Frame &frame, int reg);
+
+// Self tail call: evaluate every argument first, overwrite the parameter slots,
+// then unwind to the entry depth and jump back past the prologue.
+void codeTailCall(TreeNode *root, Frame &frame)
+{
+    for (auto arg : argList(root))
+    {
+        codeExpr(arg, frame);
+        spill(3, frame);
+    }
+    for (int i = frame.params.size() - 1; i >= 0; i--)
+    {
+        int reg = varRegister(frame, frame.params[i]);
+        if (reg != 0)
+        {
+            reload(reg, frame);
+            continue;
+        }
+        reload(5, frame);
+        sw(5, varOffset(frame, frame.params[i]), frame.base);
+    }
+    beq(0, 0, "tail" + frame.method.name);
+}
 
-void codeExpr(TreeNode *root, map<string, int> offset_table)
+void codeExpr(TreeNode *root, Frame &frame)
 {
     if (root->rule.lhs == "expr")
     {
         if (root->rule.rhs[0] == "term")
         {
-            codeExpr(getChild(root, "term", 1), offset_table);
+            codeExpr(getChild(root, "term", 1), frame);
+        }
+        else if (simpleFactor(getChild(root, "term", 1)) != nullptr)
+        {
+            // a variable or constant on the right is used in place, with
+            // constant pointer offsets scaled at compile time
+            string leftType = getChild(root, "expr", 1)->type;
+            string rightType = getChild(root, "term", 1)->type;
+            TreeNode *right = simpleFactor(getChild(root, "term", 1));
+            codeExpr(getChild(root, "expr", 1), frame);
+            int operand;
+            long long value;
+            if (leftType == "int*" && rightType == "int" && constantOperand(right, value))
+            {
+                int offset = (unsigned int)(value * 4);
+                operand = constantRegister(to_string(offset), frame);
+                if (operand == -1)
+                {
+                    operand = 5;
+                    lis(5);
+                    word(offset);
+                }
+            }
+            else
+            {
+                operand = codeOperand(right, frame, 5);
+                if (leftType == "int*" && rightType == "int")
+                {
+                    add(5, operand, operand);
+                    add(5, 5, 5);
+                    operand = 5;
+                }
+            }
+            if (leftType == "int" && rightType == "int*")
+            {
+                add(3, 3, 3);
+                add(3, 3, 3);
+            }
+            if (root->children[1]->token.kind == "PLUS")
+            {
+                add(3, 3, operand);
+            }
+            else
+            {
+                sub(3, 3, operand);
+            }
+            if (leftType == "int*" && rightType == "int*")
+            {
+                lis(5);
+                word(1 << 30);
+                mult(3, 5);
+                mfhi(3);
+            }
         }
         else
         {
-            codeExpr(getChild(root, "expr", 1), offset_table);
-            push(3);
-            codeExpr(getChild(root, "term", 1), offset_table);
-            pop(5);
+            codeExpr(getChild(root, "expr", 1), frame);
+            spill(3, frame);
+            codeExpr(getChild(root, "term", 1), frame);
+            reload(5, frame);
             if (root->children[1]->token.kind == "PLUS")
             {
+                // scale the int operand by 4 with two doublings
                 if (getChild(root, "expr", 1)->type == "int*")
                 {
-                    mult(3, 4);
-                    mflo(3);
+                    add(3, 3, 3);
+                    add(3, 3, 3);
                 }
                 if (getChild(root, "term", 1)->type == "int*")
                 {
-                    mult(5, 4);
-                    mflo(5);
+                    add(5, 5, 5);
+                    add(5, 5, 5);
                 }
                 add(3, 5, 3);
             }
@@ -1236,15 +4970,19 @@ void codeExpr(TreeNode *root, map<string, int> offset_table)
             {
                 if (getChild(root, "expr", 1)->type == "int*" && getChild(root, "term", 1)->type == "int")
                 {
-                    mult(3, 4);
-                    mflo(3);
+                    add(3, 3, 3);
+                    add(3, 3, 3);
                     sub(3, 5, 3);
                 }
                 else if (getChild(root, "expr", 1)->type == "int*" && getChild(root, "term", 1)->type == "int*")
                 {
+                    // the difference is a multiple of 4, so dividing is an
+                    // arithmetic shift by 2: the high word of a mult by 2^30
                     sub(3, 5, 3);
-                    divide(3, 4);
-                    mflo(3);
+                    lis(5);
+                    word(1 << 30);
+                    mult(3, 5);
+                    mfhi(3);
                 }
                 else
                 {
@@ -1257,14 +4995,34 @@ void codeExpr(TreeNode *root, map<string, int> offset_table)
     {
         if (root->rule.rhs[0] == "factor")
         {
-            codeExpr(getChild(root, "factor", 1), offset_table);
+            codeExpr(getChild(root, "factor", 1), frame);
         }
         else
         {
-            codeExpr(getChild(root, "term", 1), offset_table);
-            push(3);
-            codeExpr(getChild(root, "factor", 1), offset_table);
-            pop(5);
+            string op = root->children[1]->token.kind;
+            long long value;
+            if (op == "STAR" && constantOperand(getChild(root, "factor", 1), value))
+            {
+                codeExpr(getChild(root, "term", 1), frame);
+                multiplyConstant(value);
+                return;
+            }
+            if (op == "STAR" && constantOperand(getChild(root, "term", 1), value))
+            {
+                codeExpr(getChild(root, "factor", 1), frame);
+                multiplyConstant(value);
+                return;
+            }
+            if (op != "STAR" && constantOperand(getChild(root, "factor", 1), value) && value != 0)
+            {
+                codeExpr(getChild(root, "term", 1), frame);
+                divideConstant(value, op == "PCT");
+                return;
+            }
+            codeExpr(getChild(root, "term", 1), frame);
+            spill(3, frame);
+            codeExpr(getChild(root, "factor", 1), frame);
+            reload(5, frame);
             if (root->children[1]->token.kind == "STAR")
             {
                 mult(3, 5);
@@ -1286,13 +5044,28 @@ void codeExpr(TreeNode *root, map<string, int> offset_table)
     {
         if (root->rule.rhs[0] == "ID" && root->rule.rhs.size() == 1)
         {
-            int offset = offset_table[getChild(root, "ID", 1)->token.lexeme];
-            lw(3, offset, 29);
+            string name = getChild(root, "ID", 1)->token.lexeme;
+            if (varRegister(frame, name) != 0)
+            {
+                add(3, varRegister(frame, name), 0);
+            }
+            else
+            {
+                lw(3, varOffset(frame, name), frame.base);
+            }
         }
         else if (root->rule.rhs[0] == "NUM")
         {
-            lis(3);
-            word(getChild(root, "NUM", 1)->token.lexeme);
+            string value = getChild(root, "NUM", 1)->token.lexeme;
+            if (constantRegister(value, frame) != -1)
+            {
+                add(3, constantRegister(value, frame), 0);
+            }
+            else
+            {
+                lis(3);
+                word(value);
+            }
         }
         else if (root->rule.rhs[0] == "NULL")
         {
@@ -1301,221 +5074,347 @@ void codeExpr(TreeNode *root, map<string, int> offset_table)
         }
         else if (root->rule.rhs[0] == "LPAREN")
         {
-            codeExpr(getChild(root, "expr", 1), offset_table);
+            codeExpr(getChild(root, "expr", 1), frame);
         }
         else if (root->rule.rhs[0] == "AMP")
         {
-            codeLvalue(getChild(root, "lvalue", 1), offset_table);
+            codeLvalue(getChild(root, "lvalue", 1), frame);
         }
         else if (root->rule.rhs[0] == "STAR")
         {
-            codeExpr(getChild(root, "factor", 1), offset_table);
+            codeExpr(getChild(root, "factor", 1), frame);
             lw(3, 0, 3);
         }
+        else if (frame.arrays.count(root))
+        {
+            lis(3);
+            word(slotOffset(frame, frame.arrays[root]));
+            add(3, 3, frame.base);
+        }
         else if (root->rule.rhs[0] == "NEW")
         {
-            codeExpr(getChild(root, "expr", 1), offset_table);
+            codeExpr(getChild(root, "expr", 1), frame);
             add(1, 0, 3);
-            push(31);
             jalr(10);
-            pop(31);
             bne(3, 0, to_string(1));
             add(3, 0, 11); // if $3 = 0 and new alloc failed, $3 = 1 aka null
             // if $3 !=0 and new alloc succeeds, returns $3 and goes to next instr
         }
         else if (root->rule.rhs[0] == "ID" && root->rule.rhs.back() == "RPAREN")
         {
-            push(7);
-            lis(7);
-            word("P" + getChild(root, "ID", 1)->token.lexeme);
-            if (root->rule.rhs.size() == 3)
+            // $31 is saved once in the prologue and the callee address is
+            // loaded after the arguments, so only $29 may need preserving
+            string name = getChild(root, "ID", 1)->token.lexeme;
+            bool saveFramePointer = frame.method.usesFramePointer && frame.procedures->procedureMap[name].clobbersFramePointer;
+            if (saveFramePointer)
             {
-                push(31);
-                push(29);
-                jalr(7);
-                pop(29);
-                pop(31);
-                pop(7);
+                spill(29, frame);
             }
-            if (root->rule.rhs.size() == 4)
+            // arguments go straight to the bottom of the frame, where the
+            // callee expects them, unless a later argument makes a call that
+            // would overwrite them first
+            vector<TreeNode *> args = argList(root);
+            int count = args.size();
+            vector<int> spilled;
+            for (int j = 0; j < count; j++)
             {
-                push(31);
-                push(29);
-                TreeNode *arglist = getChild(root, "arglist", 1);
-                int count = 0;
-                while (arglist->children.size() == 3)
+                codeExpr(args[j], frame);
+                bool laterCall = false;
+                for (int k = j + 1; k < count; k++)
                 {
-                    codeExpr(getChild(arglist, "expr", 1), offset_table);
-                    push(3);
-                    arglist = arglist->children[2];
-                    count++;
+                    laterCall = laterCall || hasCall(args[k]);
                 }
-                if (arglist->rule.rhs.size() == 1)
+                if (laterCall)
                 {
-                    codeExpr(getChild(arglist, "expr", 1), offset_table);
-                    push(3);
-                    count++;
+                    spill(3, frame);
+                    spilled.push_back(j);
                 }
-                jalr(7);
-                for (int i = 0; i < count; i++)
+                else
                 {
-                    pop();
+                    sw(3, 4 * (count - 1 - j), 30);
                 }
-                pop(29);
-                pop(31);
-                pop(7);
+            }
+            for (int j = spilled.size() - 1; j >= 0; j--)
+            {
+                reload(5, frame);
+                sw(5, 4 * (count - 1 - spilled[j]), 30);
+            }
+            lis(7);
+            word("P" + name);
+            jalr(7);
+            if (saveFramePointer)
+            {
+                reload(29, frame);
             }
         }
     }
 }
 
-void codeLvalue(TreeNode *root, map<string, int> offset_table)
+void codeLvalue(TreeNode *root, Frame &frame)
 {
     if (root->rule.rhs[0] == "ID")
     {
-        int offset = offset_table[getChild(root, "ID", 1)->token.lexeme];
+        int offset = varOffset(frame, getChild(root, "ID", 1)->token.lexeme);
         lis(3);
         word(offset);
-        add(3, 3, 29);
+        add(3, 3, frame.base);
     }
     else if (root->rule.rhs[0] == "STAR")
     {
-        codeExpr(getChild(root, "factor", 1), offset_table);
+        codeExpr(getChild(root, "factor", 1), frame);
     }
     else if (root->rule.rhs[0] == "LPAREN")
     {
-        codeLvalue(getChild(root, "lvalue", 1), offset_table);
+        codeLvalue(getChild(root, "lvalue", 1), frame);
     }
 }
 
-void codeTest(TreeNode *root, map<string, int> offset_table, string stm_kind, int globalcount)
+// Register that always holds value, or -1 if it has to be loaded.
+int constantRegister(string value, Frame &frame)
 {
-    TreeNode *firstArg = getChild(root, "expr", 1);
-    TreeNode *secondArg = getChild(root, "expr", 2);
-
-    codeExpr(firstArg, offset_table);
-    push(3);
-    codeExpr(secondArg, offset_table);
-    pop(5);
-
-    string label = "";
-    label = "after" + stm_kind + to_string(globalcount);
-
-    if (root->rule.rhs[1] == "EQ")
+    if (frame.method.constants.count(value))
     {
-        bne(3, 5, label); // jump to else or after while loop
+        return frame.method.constants[value];
     }
-    else if (root->rule.rhs[1] == "NE")
+    if (value == "0")
     {
-        beq(3, 5, label);
+        return 0;
     }
-    else if (root->rule.rhs[1] == "LT" || root->rule.rhs[1] == "GT" || root->rule.rhs[1] == "LE" || root->rule.rhs[1] == "GE")
+    if (value == "1")
     {
-        // how to know when to use slt? vs sltu?
-        if (getChild(root, "expr", 1)->type == "int*" && root->rule.rhs[1] == "LT")
-        {
-            sltu(3, 5, 3); // if lhs<rhs : $3 = 1 ; if lhs>=rhs : $3 = 0
-            beq(3, 0, label);
-        }
-        else if (getChild(root, "expr", 1)->type == "int*" && root->rule.rhs[1] == "LE")
+        return 11;
+    }
+    if (value == "4")
+    {
+        return 4;
+    }
+    return -1;
+}
+
+// Load a simple factor into a register without going through the stack.
+// Returns the register that holds the value: $0 for 0, $11 for 1 and NULL,
+// $4 for 4, otherwise reg.
+int codeOperand(TreeNode *factor, Frame &frame, int reg)
+{
+    if (factor->rule.rhs[0] == "NULL")
+    {
+        return 11;
+    }
+    if (factor->rule.rhs[0] == "NUM")
+    {
+        string value = getChild(factor, "NUM", 1)->token.lexeme;
+        if (constantRegister(value, frame) != -1)
         {
-            sltu(3, 3, 5); // if lhs>rhs : $3 = 1 ; if lhs<=rhs : $3 = 0
-            beq(3, 11, label);
+            return constantRegister(value, frame);
         }
-        else if (getChild(root, "expr", 1)->type == "int*" && root->rule.rhs[1] == "GT")
+        lis(reg);
+        word(value);
+        return reg;
+    }
+    string name = getChild(factor, "ID", 1)->token.lexeme;
+    if (varRegister(frame, name) != 0)
+    {
+        return varRegister(frame, name);
+    }
+    lw(reg, varOffset(frame, getChild(factor, "ID", 1)->token.lexeme), frame.base);
+    return reg;
+}
+
+// Branch to label when the test is false, or when it is true if jumpIfTrue is set.
+void codeTest(TreeNode *root, Frame &frame, string label, bool jumpIfTrue)
+{
+    TreeNode *firstArg = getChild(root, "expr", 1);
+    TreeNode *secondArg = getChild(root, "expr", 2);
+    TreeNode *firstFactor = simpleFactor(firstArg);
+    TreeNode *secondFactor = simpleFactor(secondArg);
+
+    // evaluate both sides into distinct registers lhs and rhs, only going
+    // through the stack when both sides are compound
+    int lhs = 5;
+    int rhs = 3;
+    if (secondFactor != nullptr)
+    {
+        if (firstFactor != nullptr)
         {
-            sltu(3, 3, 5); // if rhs<lhs : $3 = 1 ; if rhs>=lhs : $3 = 0
-            beq(3, 0, label);
+            lhs = codeOperand(firstFactor, frame, 3);
         }
-        else if (getChild(root, "expr", 1)->type == "int*" && root->rule.rhs[1] == "GE")
+        else
         {
-            sltu(3, 5, 3); // if lhs<rhs : $3 = 1 ; if lhs>=rhs : $3 = 0
-            beq(3, 11, label);
+            codeExpr(firstArg, frame);
+            lhs = 3;
         }
-        else if (getChild(root, "expr", 1)->type == "int" && root->rule.rhs[1] == "LT")
+        rhs = codeOperand(secondFactor, frame, 5);
+    }
+    else if (isConstFactor(firstFactor) || (firstFactor != nullptr && !hasCall(secondArg)))
+    {
+        // a constant or a variable no call can modify may be loaded after the rhs
+        codeExpr(secondArg, frame);
+        lhs = codeOperand(firstFactor, frame, 5);
+    }
+    else
+    {
+        codeExpr(firstArg, frame);
+        spill(3, frame);
+        codeExpr(secondArg, frame);
+        reload(5, frame);
+    }
+
+    string op = root->rule.rhs[1];
+    if ((op == "EQ" && !jumpIfTrue) || (op == "NE" && jumpIfTrue))
+    {
+        bne(lhs, rhs, label);
+    }
+    else if (op == "EQ" || op == "NE")
+    {
+        beq(lhs, rhs, label);
+    }
+    else
+    {
+        // pointers compare unsigned
+        bool isPointer = firstArg->type == "int*";
+        // LT and GE test lhs<rhs, GT and LE test rhs<lhs
+        int s = (op == "LT" || op == "GE") ? lhs : rhs;
+        int t = (op == "LT" || op == "GE") ? rhs : lhs;
+        if (isPointer)
         {
-            slt(3, 5, 3); // if lhs<rhs : $3 = 1 ; if lhs>=rhs : $3 = 0
-            beq(3, 0, label);
+            sltu(3, s, t);
         }
-        else if (getChild(root, "expr", 1)->type == "int" && root->rule.rhs[1] == "LE")
+        else
         {
-            slt(3, 3, 5); // if rhs<lhs : $3 = 1 ; if lhs<=rhs : $3 = 0
-            beq(3, 11, label);
+            slt(3, s, t);
         }
-        else if (getChild(root, "expr", 1)->type == "int" && root->rule.rhs[1] == "GT")
+        // LT and GT hold when $3 = 1 ; LE and GE hold when $3 = 0
+        if ((op == "LT" || op == "GT") != jumpIfTrue)
         {
-            slt(3, 3, 5); // if rhs<lhs : $3 = 1 ; if rhs>=lhs : $3 = 0
             beq(3, 0, label);
         }
-        else if (getChild(root, "expr", 1)->type == "int" && root->rule.rhs[1] == "GE")
+        else
         {
-            slt(3, 5, 3); // if lhs<rhs : $3 = 1 ; if lhs>=rhs : $3 = 0
-            beq(3, 11, label);
+            bne(3, 0, label);
         }
     }
 }
 
-void codeStatementsTOStatement(TreeNode *root, map<string, int> offset_table, int &globalifcount, int &globalwhilecount);
+void codeStatementsTOStatement(TreeNode *root, Frame &frame, int &globalifcount, int &globalwhilecount);
 
-void codeStatement(TreeNode *root, map<string, int> offset_table, int &globalifcount, int &globalwhilecount)
+// Bump the counter of a block in instrumented code, using $5 and $14.
+void countBlock(TreeNode *block, Frame &frame)
 {
-    if (root->rule.rhs[0] == "lvalue")
+    if (!frame.procedures->instrument || block->counter < 0)
+    {
+        return;
+    }
+    lis(14);
+    word("count" + to_string(block->counter));
+    lw(5, 0, 14);
+    add(5, 5, 11);
+    sw(5, 0, 14);
+}
+
+// Print every counter and then how many there are, keeping $3.
+void printCounters(int counters)
+{
+    push(3);
+    for (int k = 0; k < counters; k++)
+    {
+        lis(14);
+        word("count" + to_string(k));
+        lw(1, 0, 14);
+        jalr(13);
+    }
+    lis(1);
+    word(counters);
+    jalr(13);
+    pop(3);
+}
+
+void codeStatement(TreeNode *root, Frame &frame, int &globalifcount, int &globalwhilecount)
+{
+    if (root->rule.rhs[0] == "lvalue" && frame.method.tailCalls.count(innerNode(getChild(root, "expr", 1))))
+    {
+        codeTailCall(innerNode(getChild(root, "expr", 1)), frame);
+    }
+    else if (root->rule.rhs[0] == "lvalue" && lvalueRegister(getChild(root, "lvalue", 1), frame) != 0)
     {
-        codeLvalue(getChild(root, "lvalue", 1), offset_table);
-        push(3);
-        codeExpr(getChild(root, "expr", 1), offset_table);
-        pop(5);
+        codeExpr(getChild(root, "expr", 1), frame);
+        add(lvalueRegister(getChild(root, "lvalue", 1), frame), 3, 0);
+    }
+    else if (root->rule.rhs[0] == "lvalue")
+    {
+        codeLvalue(getChild(root, "lvalue", 1), frame);
+        spill(3, frame);
+        codeExpr(getChild(root, "expr", 1), frame);
+        reload(5, frame);
         sw(3, 0, 5);
     }
     else if (root->rule.rhs[0] == "PRINTLN")
     {
-        codeExpr(getChild(root, "expr", 1), offset_table);
+        codeExpr(getChild(root, "expr", 1), frame);
         add(1, 0, 3); // add to register $1 for print parameter
-        push(31);     // save $31 (PC) for jalr
-        jalr(13);
-        pop(31);
+        jalr(13);     // $31 was saved in the prologue
     }
     else if (root->rule.rhs[0] == "IF")
     {
         int currentIfIndex = globalifcount;
         globalifcount++;
-        codeTest(getChild(root, "test", 1), offset_table, "if", currentIfIndex);
+        TreeNode *thenArm = getChild(root, "statements", 1);
+        TreeNode *elseArm = getChild(root, "statements", 2);
+        // the arm placed second is reached without a jump, so a then arm
+        // the profile shows running more often goes after the else arm
+        if (!elseArm->rule.rhs.empty() && regionWeight(thenArm, *frame.procedures, 0) > regionWeight(elseArm, *frame.procedures, 0))
+        {
+            codeTest(getChild(root, "test", 1), frame, "then" + to_string(currentIfIndex), true);
+            countBlock(elseArm, frame);
+            codeStatementsTOStatement(elseArm, frame, globalifcount, globalwhilecount);
+            beq(0, 0, "afterelse" + to_string(currentIfIndex));
+            label("then" + to_string(currentIfIndex));
+            countBlock(thenArm, frame);
+            codeStatementsTOStatement(thenArm, frame, globalifcount, globalwhilecount);
+            label("afterelse" + to_string(currentIfIndex));
+            return;
+        }
+        codeTest(getChild(root, "test", 1), frame, "afterif" + to_string(currentIfIndex), false);
         // code for if statements
-        codeStatementsTOStatement(getChild(root, "statements", 1), offset_table, globalifcount, globalwhilecount);
+        countBlock(thenArm, frame);
+        codeStatementsTOStatement(thenArm, frame, globalifcount, globalwhilecount);
         // after jump to after else (will not run else code)
-        lis(14);
-        word("afterelse" + to_string(currentIfIndex));
-        jr(14);
+        beq(0, 0, "afterelse" + to_string(currentIfIndex));
         label("afterif" + to_string(currentIfIndex));
         // code for else statements
-        codeStatementsTOStatement(getChild(root, "statements", 2), offset_table, globalifcount, globalwhilecount);
+        countBlock(elseArm, frame);
+        codeStatementsTOStatement(elseArm, frame, globalifcount, globalwhilecount);
         label("afterelse" + to_string(currentIfIndex));
     }
     else if (root->rule.rhs[0] == "WHILE")
     {
         int currentWhileIndex = globalwhilecount;
         globalwhilecount++;
+        // rotated loop: guard test on entry, then the test is repeated at the
+        // bottom so each iteration takes a single conditional back-edge
+        codeTest(getChild(root, "test", 1), frame, "afterwhile" + to_string(currentWhileIndex), false);
         label("while" + to_string(currentWhileIndex));
-        codeTest(getChild(root, "test", 1), offset_table, "while", currentWhileIndex);
         // code for while statements
-        codeStatementsTOStatement(getChild(root, "statements", 1), offset_table, globalifcount, globalwhilecount);
-        lis(14);
-        word("while" + to_string(currentWhileIndex));
-        jr(14);
+        countBlock(getChild(root, "statements", 1), frame);
+        codeStatementsTOStatement(getChild(root, "statements", 1), frame, globalifcount, globalwhilecount);
+        // loops rewritten to walk a pointer carry their own bottom test
+        map<TreeNode *, TreeNode *> &bottomTests = frame.method.bottomTests;
+        TreeNode *bottom = bottomTests.count(root) ? bottomTests[root] : getChild(root, "test", 1);
+        codeTest(bottom, frame, "while" + to_string(currentWhileIndex), true);
         label("afterwhile" + to_string(currentWhileIndex));
     }
     else if (root->rule.rhs[0] == "DELETE")
     {
-        codeExpr(getChild(root, "expr", 1), offset_table);
-        add(1, 0, 3);             // $1 will hold address of expr
-        beq(1, 11, to_string(5)); // if $1 is NULL, should do nothing so skip delete instruction
-        push(31);
+        codeExpr(getChild(root, "expr", 1), frame);
+        add(1, 0, 3); // $1 will hold address of expr
+        if (!frame.method.checkedDeletes.count(root))
+        {
+            beq(1, 11, to_string(1)); // if $1 is NULL, should do nothing so skip delete instruction
+        }
         jalr(9);
-        pop(31);
     }
 }
 
-void codeStatementsTOStatement(TreeNode *root, map<string, int> offset_table, int &globalifcount, int &globalwhilecount)
+void codeStatementsTOStatement(TreeNode *root, Frame &frame, int &globalifcount, int &globalwhilecount)
 {
     if (root->rule.rhs.empty())
     {
@@ -1523,16 +5422,152 @@ void codeStatementsTOStatement(TreeNode *root, map<string, int> offset_table, in
     }
     else
     {
-        codeStatementsTOStatement(getChild(root, "statements", 1), offset_table, globalifcount, globalwhilecount);
-        codeStatement(getChild(root, "statement", 1), offset_table, globalifcount, globalwhilecount);
+        codeStatementsTOStatement(getChild(root, "statements", 1), frame, globalifcount, globalwhilecount);
+        codeStatement(getChild(root, "statement", 1), frame, globalifcount, globalwhilecount);
     }
 }
 
-void codeProcedure(TreeNode *root, int &globalifcount, int &globalwhilecount, Procedure method)
+// Value a declaration initializes its variable to, with NULL as "1".
+string initialValue(TreeNode *dcls)
 {
-    int localvarCount = 0;
-    map<string, int> proc_offset_table;
-    label("P" + getChild(root, "ID", 1)->token.lexeme);
+    if (dcls->children[3]->token.kind == "NULL")
+    {
+        return "1";
+    }
+    return dcls->children[3]->token.lexeme;
+}
+
+// Give the locals kept in memory consecutive slots from slot on, putting the
+// ones initialized to 0 first so they can be cleared together. Returns the
+// next free slot.
+int assignLocalSlots(TreeNode *vars, Frame &frame, int slot)
+{
+    frame.zeroStart = slot;
+    frame.zeroCount = 0;
+    for (int zero = 1; zero >= 0; zero--)
+    {
+        for (auto dcls : dclsList(vars))
+        {
+            string name = getChild(dcls, "dcl", 1)->children[1]->token.lexeme;
+            if (varRegister(frame, name) == 0 && (initialValue(dcls) == "0") == (zero == 1))
+            {
+                frame.offset_table[name] = -4 * slot;
+                slot++;
+                frame.zeroCount += zero;
+            }
+        }
+    }
+    return slot;
+}
+
+// Put the frame arrays below the memory locals, first word at the lowest
+// address. Returns the next free slot.
+int assignArraySlots(Frame &frame, int slot)
+{
+    for (auto array : frame.method.arrays)
+    {
+        long long words;
+        constantOperand(getChild(array, "expr", 1), words);
+        slot += words;
+        frame.arrays[array] = slot - 1;
+    }
+    return slot;
+}
+
+// Local initializers, statements and return value of a procedure or wain.
+// Returns false when the return value is a tail call, which needs no epilogue.
+bool codeBody(TreeNode *root, Frame &frame, int &globalifcount, int &globalwhilecount)
+{
+    countBlock(root, frame);
+
+    // long runs of zeroed slots are cleared by a loop from the lowest address
+    bool clearLoop = frame.zeroCount >= 16;
+    if (clearLoop)
+    {
+        lis(5);
+        word(slotOffset(frame, frame.zeroStart + frame.zeroCount - 1));
+        add(5, 5, frame.base);
+        lis(3);
+        word(slotOffset(frame, frame.zeroStart) + 4);
+        add(3, 3, frame.base);
+        label("clear" + frame.method.name);
+        sw(0, 0, 5);
+        add(5, 5, 4);
+        bne(5, 3, "clear" + frame.method.name);
+    }
+
+    for (auto dcls : dclsList(getChild(root, "dcls", 1)))
+    {
+        string name = getChild(dcls, "dcl", 1)->children[1]->token.lexeme;
+        string value = initialValue(dcls);
+        int reg = varRegister(frame, name);
+        int source = constantRegister(value, frame);
+        if ((reg == 0 && clearLoop && value == "0") || frame.method.deadInitializers.count(name))
+        {
+            continue;
+        }
+        // 0, 1 (and NULL) and 4 are copied from $0, $11 and $4
+        if (source == -1)
+        {
+            source = reg != 0 ? reg : 5;
+            lis(source);
+            word(value);
+        }
+        if (reg == 0)
+        {
+            sw(source, varOffset(frame, name), frame.base);
+        }
+        else if (reg != source)
+        {
+            add(reg, source, 0);
+        }
+    }
+
+    codeStatementsTOStatement(getChild(root, "statements", 1), frame, globalifcount, globalwhilecount);
+
+    // return expr
+    root = getChild(root, "expr", 1);
+    if (frame.method.tailCalls.count(innerNode(root)))
+    {
+        codeTailCall(innerNode(root), frame);
+        return false;
+    }
+    codeExpr(root, frame);
+    return true;
+}
+
+// Generate the body once without keeping it to find how many temporaries
+// the frame needs; frame.size then covers slots, temporaries and arguments.
+void sizeFrame(TreeNode *root, Frame &frame, int slots, int globalifcount, int globalwhilecount)
+{
+    size_t mark = code.size();
+    frame.outgoing = maxArgs(root);
+    frame.temps = 0;
+    frame.maxTemps = 0;
+    frame.size = slots + frame.outgoing;
+    codeBody(root, frame, globalifcount, globalwhilecount);
+    code.resize(mark);
+    frame.size = slots + frame.maxTemps + frame.outgoing;
+}
+
+// Load the literals the procedure keeps in registers.
+void loadConstants(Frame &frame)
+{
+    for (auto &entry : frame.method.constants)
+    {
+        lis(entry.second);
+        word(entry.first);
+    }
+}
+
+void codeProcedure(TreeNode *root, int &globalifcount, int &globalwhilecount, Procedure method, ProcedureTable &table)
+{
+    Frame frame;
+    frame.method = method;
+    frame.procedures = &table;
+    frame.base = method.usesFramePointer ? 29 : 30;
+    // params are pushed by caller, the last one ends up at 0($30) on entry;
+    // offsets are relative to $29 = $30 - 4 on entry
     int i = method.signature.size();
     TreeNode *params = getChild(root, "params", 1);
     if (!params->rule.rhs.empty() && params->rule.rhs[0] == "paramlist")
@@ -1540,62 +5575,169 @@ void codeProcedure(TreeNode *root, int &globalifcount, int &globalwhilecount, Pr
         params = getChild(params, "paramlist", 1);
         while (params->rule.rhs.size() > 1)
         {
-            proc_offset_table[getChild(params, "dcl", 1)->children[1]->token.lexeme] = i * 4;
+            frame.params.push_back(getChild(params, "dcl", 1)->children[1]->token.lexeme);
+            frame.offset_table[frame.params.back()] = i * 4;
             i--;
             params = getChild(params, "paramlist", 1);
         }
-        proc_offset_table[getChild(params, "dcl", 1)->children[1]->token.lexeme] = i * 4;
+        frame.params.push_back(getChild(params, "dcl", 1)->children[1]->token.lexeme);
+        frame.offset_table[frame.params.back()] = i * 4;
         i--;
     }
-    // params are pushed by caller
-    // set up frame pointer
-    sub(29, 30, 4);
 
-    // push and set up local variables and offset table
-    TreeNode *vars = getChild(root, "dcls", 1);
-    while (vars->children.size() > 1)
+    // slot 0 holds $31 in procedures that make calls, then the saved
+    // registers and the locals kept in memory
+    int slot = method.leaf ? 0 : 1;
+    slot += method.savedRegisters.size();
+    slot = assignLocalSlots(getChild(root, "dcls", 1), frame, slot);
+    slot = assignArraySlots(frame, slot);
+    sizeFrame(root, frame, slot, globalifcount, globalwhilecount);
+
+    label("P" + getChild(root, "ID", 1)->token.lexeme);
+    if (method.usesFramePointer)
     {
-        proc_offset_table[getChild(vars, "dcl", 1)->children[1]->token.lexeme] = -4 * localvarCount;
-        lis(5);
-        if (vars->children[3]->token.kind == "NULL")
-        {
-            word(1);
-        }
-        else if (vars->children[3]->token.kind == "NUM")
+        // set up frame pointer
+        sub(29, 30, 4);
+    }
+    reserve(frame.size);
+    slot = 0;
+    if (!method.leaf)
+    {
+        // save the return address once for every jalr in the body
+        sw(31, slotOffset(frame, slot), frame.base);
+        slot++;
+    }
+    for (auto reg : method.savedRegisters)
+    {
+        sw(reg, slotOffset(frame, slot), frame.base);
+        slot++;
+    }
+    for (auto param : frame.params)
+    {
+        if (varRegister(frame, param) != 0)
         {
-            word(getChild(vars, "NUM", 1)->token.lexeme);
+            lw(varRegister(frame, param), varOffset(frame, param), frame.base);
         }
-        push(5);
-        localvarCount++;
-        vars = getChild(vars, "dcls", 1);
+    }
+    loadConstants(frame);
+    if (!method.tailCalls.empty())
+    {
+        // locals are reinitialized on every pass through a tail call
+        label("tail" + method.name);
     }
 
-    codeStatementsTOStatement(getChild(root, "statements", 1), proc_offset_table, globalifcount, globalwhilecount);
-
-    // return expr
-    root = getChild(root, "expr", 1);
-    codeExpr(root, proc_offset_table);
+    if (!codeBody(root, frame, globalifcount, globalwhilecount))
+    {
+        return;
+    }
 
-    // clean up stack and return
-    for (int i = 0; i < localvarCount; i++)
+    // restore saved registers, release the frame and return
+    slot = method.leaf ? 0 : 1;
+    for (auto reg : method.savedRegisters)
     {
-        pop();
+        lw(reg, slotOffset(frame, slot), frame.base);
+        slot++;
     }
+    if (!method.leaf)
+    {
+        lw(31, slotOffset(frame, 0), frame.base);
+    }
+    drop(frame.size);
     jr(31);
 }
 
+// Runtime routines the subtree calls, leaving out new for frame arrays.
+void collectRuntime(TreeNode *root, Procedure &current, set<string> &runtime)
+{
+    if (find(current.arrays.begin(), current.arrays.end(), root) != current.arrays.end())
+    {
+        return;
+    }
+    if (root->tokenvrule == "token")
+    {
+        string kind = root->token.kind;
+        if (kind == "PRINTLN" || kind == "NEW" || kind == "DELETE")
+        {
+            runtime.insert(kind == "PRINTLN" ? "print" : kind == "NEW" ? "new" : "delete");
+        }
+    }
+    for (auto child : root->children)
+    {
+        collectRuntime(child, current, runtime);
+    }
+}
+
+// Append the routines of WLP4_RUNTIME that are needed; the data after them
+// goes with init, which sets up the heap.
+void emitRuntime(set<string> &runtime)
+{
+    stringstream text(WLP4_RUNTIME);
+    string line;
+    bool needed = false;
+    while (getline(text, line))
+    {
+        line = squish(line.substr(0, line.find(';')));
+        if (line == "print:" || line == "init:" || line == "new:" || line == "delete:" || line == "rtHeap:")
+        {
+            needed = runtime.count(line == "rtHeap:" ? "init" : line.substr(0, line.size() - 1));
+        }
+        if (line != "" && needed)
+        {
+            emit(line);
+        }
+    }
+}
+
 void codegen(TreeNode *start, ProcedureTable table)
 {
-    cout << ".import print\n";
-    cout << ".import init\n.import new\n.import delete\n";
-    lis(13); // $13 has label for print procedure
-    word("print");
-    lis(12); // $12 has label init
-    word("init");
-    lis(10); // $10 has label new
-    word("new");
-    lis(9); // $9 has label delete
-    word("delete");
+    analyzeCalls(start, table);
+
+    // only the runtime routines the program calls are imported and loaded
+    set<string> runtime;
+    for (auto procedures = getChild(start, "procedures", 1);; procedures = getChild(procedures, "procedures", 1))
+    {
+        TreeNode *method = procedures->children[0];
+        collectRuntime(method, table.procedureMap[method->rule.lhs == "main" ? "wain" : getChild(method, "ID", 1)->token.lexeme], runtime);
+        if (method->rule.lhs == "main")
+        {
+            break;
+        }
+    }
+    if (table.instrument)
+    {
+        runtime.insert("print");
+    }
+    if (runtime.count("new") || runtime.count("delete"))
+    {
+        runtime.insert("init");
+    }
+    for (string name : {"print", "init", "new", "delete"})
+    {
+        if (runtime.count(name) && !table.builtinRuntime)
+        {
+            emit(".import " + name);
+        }
+    }
+    if (runtime.count("print"))
+    {
+        lis(13); // $13 has label for print procedure
+        word("print");
+    }
+    if (runtime.count("init"))
+    {
+        lis(12); // $12 has label init
+        word("init");
+    }
+    if (runtime.count("new"))
+    {
+        lis(10); // $10 has label new
+        word("new");
+    }
+    if (runtime.count("delete"))
+    {
+        lis(9); // $9 has label delete
+        word("delete");
+    }
     lis(4); // load 4 into $4
     word(4);
     lis(11); // load 1 into $11
@@ -1604,7 +5746,6 @@ void codegen(TreeNode *start, ProcedureTable table)
     word("wain");
     jr(6);
 
-    int localvarCount = 0;
     int globalifcount = 0;
     int globalwhilecount = 0;
 
@@ -1614,78 +5755,270 @@ void codegen(TreeNode *start, ProcedureTable table)
     while (start->children.size() > 1)
     {
         Procedure method = table.get(getChild(start, "procedure", 1)->children[1]->token.lexeme);
-        codeProcedure(getChild(start, "procedure", 1), globalifcount, globalwhilecount, method);
+        codeProcedure(getChild(start, "procedure", 1), globalifcount, globalwhilecount, method, table);
         start = getChild(start, "procedures", 1);
     }
 
     // traverse node to main node
     start = getChild(start, "main", 1);
 
+    Frame frame;
+    frame.method = table.get("wain");
+    frame.procedures = &table;
+    frame.base = frame.method.usesFramePointer ? 29 : 30;
+
+    // slots for the parameters kept in memory, $31, then memory locals
+    int slot = 0;
+    for (int j = 1; j <= 2; j++)
+    {
+        string param = getChild(start, "dcl", j)->children[1]->token.lexeme;
+        if (varRegister(frame, param) == 0)
+        {
+            frame.offset_table[param] = -4 * slot;
+            slot++;
+        }
+    }
+    // $31 only needs saving if wain makes a call of its own
+    bool saveReturn = !frame.method.callees.empty() || usesRuntime(start, frame.method) || runtime.count("init") || table.instrument;
+    int returnSlot = slot;
+    slot += saveReturn ? 1 : 0;
+    slot = assignLocalSlots(getChild(start, "dcls", 1), frame, slot);
+    slot = assignArraySlots(frame, slot);
+    sizeFrame(start, frame, slot, globalifcount, globalwhilecount);
+
     label("wain");
+    if (frame.method.usesFramePointer)
+    {
+        // set up frame pointer
+        sub(29, 30, 4);
+    }
+    reserve(frame.size);
+    if (saveReturn)
+    {
+        sw(31, slotOffset(frame, returnSlot), frame.base);
+    }
 
-    // push parameter vars
-    map<string, int> wain_offset_table;
-    wain_offset_table[getChild(start, "dcl", 1)->children[1]->token.lexeme] = 8;
-    wain_offset_table[getChild(start, "dcl", 2)->children[1]->token.lexeme] = 4;
-    push(1); // push register $1 (parameter 1)
-    push(2); // push register $2 (parameter 2)
+    // parameters arrive in $1 and $2, which init may use
+    for (int j = 1; j <= 2; j++)
+    {
+        string param = getChild(start, "dcl", j)->children[1]->token.lexeme;
+        if (varRegister(frame, param) != 0)
+        {
+            add(varRegister(frame, param), j, 0);
+        }
+        else
+        {
+            sw(j, varOffset(frame, param), frame.base);
+        }
+    }
 
     // for initialization
-    Procedure wainProcedure = table.get("wain");
-    push(31);
-    if (wainProcedure.signature[0] == "int")
+    if (runtime.count("init"))
     {
-        push(2);
-        add(2, 0, 0);
+        if (frame.method.signature[0] == "int")
+        {
+            add(2, 0, 0);
+        }
         jalr(12);
-        pop(2);
     }
-    else
+    loadConstants(frame);
+
+    codeBody(start, frame, globalifcount, globalwhilecount);
+    if (table.instrument)
     {
-        jalr(12);
+        printCounters(table.counters);
+    }
+
+    // clean up stack and return
+    if (saveReturn)
+    {
+        lw(31, slotOffset(frame, returnSlot), frame.base);
+    }
+    drop(frame.size);
+    jr(31);
+
+    for (int k = 0; k < table.counters && table.instrument; k++)
+    {
+        label("count" + to_string(k));
+        word(0);
+    }
+
+    if (table.builtinRuntime)
+    {
+        // the runtime goes last, its heap starts where the program ends
+        emitRuntime(runtime);
     }
-    pop(31);
+}
 
-    // set up frame pointer
-    sub(29, 30, 4);
+//// PASS MANAGER ///////////////////////////////////////////
+// The optimizations are tree-to-tree passes run between semantic analysis
+// and code generation. Each one runs from the lowest -O level listed.
+struct Pass
+{
+    string name;
+    int level;
+    function<void(TreeNode *, ProcedureTable &)> run;
+    bool onTree; // false for code generation and the passes after it
+};
 
-    // push local vars
-    TreeNode *vars = getChild(start, "dcls", 1);
+struct Options
+{
+    int level;       // -O0, -O1 or -O2 (default)
+    bool timePasses; // --time-passes: time spent in each pass on stderr
+    bool dumpIR;     // --dump-ir: the program after each pass on stderr
+    bool reportDead; // --report-dead: procedures dropped as unreachable
+    bool instrument; // --instrument: count block entries and print the counts
+    string profile;  // --profile=<file>: counts from an instrumented run
+    bool builtinRuntime; // --builtin-runtime: include print, init, new and delete
+};
 
-    while (vars->children.size() > 1)
+Options parseOptions(int argc, char *argv[])
+{
+    Options options{2, false, false, false, false, "", false};
+    for (int i = 1; i < argc; i++)
     {
-        wain_offset_table[getChild(vars, "dcl", 1)->children[1]->token.lexeme] = -4 * localvarCount;
-        lis(5);
-        if (vars->children[3]->token.kind == "NULL")
+        string arg = argv[i];
+        if (arg == "-O0" || arg == "-O1" || arg == "-O2")
         {
-            word(1);
+            options.level = arg[2] - '0';
         }
-        else
+        else if (arg == "--time-passes")
         {
-            word(vars->children[3]->token.lexeme);
+            options.timePasses = true;
+        }
+        else if (arg == "--dump-ir")
+        {
+            options.dumpIR = true;
+        }
+        else if (arg == "--report-dead")
+        {
+            options.reportDead = true;
+        }
+        else if (arg == "--instrument")
+        {
+            options.instrument = true;
+        }
+        else if (arg.rfind("--profile=", 0) == 0)
+        {
+            options.profile = arg.substr(10);
+        }
+        else if (arg == "--builtin-runtime")
+        {
+            options.builtinRuntime = true;
         }
-        push(5);
-        localvarCount++;
-        vars = getChild(vars, "dcls", 1);
     }
+    return options;
+}
 
-    // statements
-    codeStatementsTOStatement(getChild(start, "statements", 1), wain_offset_table, globalifcount, globalwhilecount);
+// Every leaf token under root separated by spaces.
+string sourceText(TreeNode *root)
+{
+    if (root->tokenvrule == "token")
+    {
+        return root->token.lexeme;
+    }
+    string text;
+    for (auto child : root->children)
+    {
+        string part = sourceText(child);
+        text += text != "" && part != "" ? " " + part : part;
+    }
+    return text;
+}
 
-    // return expr
-    start = getChild(start, "expr", 1);
-    codeExpr(start, wain_offset_table);
+void printStatements(TreeNode *statements, Procedure &current, ostream &out, int depth)
+{
+    string indent(4 * depth, ' ');
+    for (auto statement : statementList(statements))
+    {
+        string kind = statement->rule.rhs[0];
+        if (kind == "IF")
+        {
+            out << indent << "if (" << sourceText(getChild(statement, "test", 1)) << ") {" << endl;
+            printStatements(getChild(statement, "statements", 1), current, out, depth + 1);
+            out << indent << "} else {" << endl;
+            printStatements(getChild(statement, "statements", 2), current, out, depth + 1);
+            out << indent << "}" << endl;
+        }
+        else if (kind == "WHILE")
+        {
+            out << indent << "while (" << sourceText(getChild(statement, "test", 1)) << ") {" << endl;
+            printStatements(getChild(statement, "statements", 1), current, out, depth + 1);
+            out << indent << "}";
+            if (current.bottomTests.count(statement))
+            {
+                out << " // repeats while " << sourceText(current.bottomTests[statement]);
+            }
+            out << endl;
+        }
+        else
+        {
+            out << indent << sourceText(statement) << endl;
+        }
+    }
+}
 
-    // clean up stack and return
-    for (int i = 0; i < localvarCount; i++)
+// Print the program back as WLP4 source, one declaration or statement per line.
+void printSource(TreeNode *start, ProcedureTable &table, ostream &out)
+{
+    TreeNode *procedures = getChild(start, "procedures", 1);
+    while (true)
     {
-        pop();
+        TreeNode *method = procedures->rule.rhs[0] == "main" ? getChild(procedures, "main", 1) : getChild(procedures, "procedure", 1);
+        string header;
+        for (auto child : method->children)
+        {
+            if (child->token.kind == "LBRACE")
+            {
+                break;
+            }
+            header += (header == "" ? "" : " ") + sourceText(child);
+        }
+        out << header << " {" << endl;
+        for (auto dcls : dclsList(getChild(method, "dcls", 1)))
+        {
+            out << "    " << sourceText(getChild(dcls, "dcl", 1));
+            out << " = " << dcls->children[3]->token.lexeme << ";" << endl;
+        }
+        string name = method->rule.lhs == "main" ? "wain" : getChild(method, "ID", 1)->token.lexeme;
+        printStatements(getChild(method, "statements", 1), table.procedureMap[name], out, 1);
+        out << "    return " << sourceText(getChild(method, "expr", 1)) << ";" << endl
+            << "}" << endl;
+        if (method->rule.lhs == "main")
+        {
+            break;
+        }
+        procedures = getChild(procedures, "procedures", 1);
+    }
+}
+
+void runPasses(vector<Pass> &passes, TreeNode *start, ProcedureTable &table, Options &options)
+{
+    for (auto &pass : passes)
+    {
+        if (pass.level > options.level)
+        {
+            continue;
+        }
+        auto begin = chrono::steady_clock::now();
+        pass.run(start, table);
+        auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin);
+        if (options.timePasses)
+        {
+            cerr << pass.name << ": " << elapsed.count() << " us" << endl;
+        }
+        if (options.dumpIR && pass.onTree)
+        {
+            cerr << "// after " << pass.name << endl;
+            printSource(start, table, cerr);
+        }
     }
-    jr(31);
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+    Options options = parseOptions(argc, argv);
+
     // create ur dfa
     wlp4scan wlp;
     DFA *dfa = nullptr;
@@ -1722,8 +6055,48 @@ int main()
         tokensToTrees(final_tokens, cfg, tree_stack, state_stack, slr1);
 
         ProcedureTable table = collectProcedures(tree_stack[0]);
+        table.instrument = options.instrument;
+        table.builtinRuntime = options.builtinRuntime;
+        vector<string> removed;
+        vector<Pass> passes = {
+            {"profile", 0, [&](TreeNode *start, ProcedureTable &table)
+             { setUpProfile(start, table, options.profile); },
+             false},
+            {"pure-calls", 2, evaluatePureCalls, true},
+            {"inline", 2, inlineProcedures, true},
+            {"specialize", 2, specializeProcedures, true},
+            {"dead-procedures", 1, [&](TreeNode *start, ProcedureTable &table)
+             { removed = removeDeadProcedures(start, table); },
+             true},
+            {"constant-folding", 1, foldConstants, true},
+            {"frame-arrays", 1, allocateFrameArrays, true},
+            {"null-checks", 1, eliminateNullChecks, true},
+            {"licm", 2, hoistInvariantCode, true},
+            {"induction-variables", 2, reduceInductionVariables, true},
+            {"value-numbering", 1, numberValues, true},
+            {"dead-stores", 1, eliminateDeadStores, true},
+            {"codegen", 0, codegen, false},
+            {"block-layout", 1, [](TreeNode *, ProcedureTable &)
+             { layoutBlocks(); },
+             false},
+        };
+        if (options.instrument)
+        {
+            // counts for a procedure body must not depend on where it was inlined
+            passes.erase(remove_if(passes.begin(), passes.end(), [](Pass &pass)
+                                   { return pass.name == "inline"; }),
+                         passes.end());
+        }
+        runPasses(passes, tree_stack[0], table, options);
+        if (options.reportDead)
+        {
+            for (auto name : removed)
+            {
+                cerr << "removed unreachable procedure " << name << endl;
+            }
+        }
 
-        codegen(tree_stack[0], table);
+        printCode();
         // printTree(tree_stack);
 
         clean(tree_stack);